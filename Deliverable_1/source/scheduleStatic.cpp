@@ -7,27 +7,31 @@
 #include <algorithm>
 #include <ctime>
 #include <omp.h>
+#include "../../common/csr_cache.h"
+#include "../../common/spmv_kernels.h"
+#include "../../common/rcm.h"
+#include "../../common/cg.h"
+#include "../../common/spmv_iterations.h"
+#include "../../common/numa_placement.h"
+#include "../../common/thread_profile.h"
 
 using namespace std;
 
-struct Node {
-    int row, col;
-    double value;
-};
-
 int main(int argc, char* argv[]) {
     srand(time(NULL));
 
+    //the kernels of common/spmv_kernels.h use schedule(runtime): they follow the same scheduling of the loop below
+    omp_set_schedule(omp_sched_static, 0);
+
     struct timespec start, end;
     clock_t start2, end2;
 
     double execution_time_CPU, execution_time_REAL;
-/*CHECK ON THE ARGUMENT (THE FILE OF THE SPARSE MATRIX)*/
-    if(argc != 2){
-        fprintf(stderr,"[ERR] Missing argument (or extra argument added) when executing the file\n");
+/*CHECK ON THE ARGUMENTS (THE FILE OF THE SPARSE MATRIX AND THE OPTIONAL FLAGS OF common/spmv_options.h)*/
+    SpmvOptions opts;
+    if(parse_options(argc, argv, opts) != 0)
         return 1;
-    }
-    char* filename = argv[1];
+    const char* filename = opts.matrix_path;
     size_t len = strlen(filename);
     size_t ext_len = 4; // Lunghezza di ".mtx"
 
@@ -36,114 +40,116 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-/*OPENING THE FILE*/
-    FILE* file = fopen(argv[1], "r");
-    if (!file) {
-        fprintf(stderr,"[ERR] Error while opening the file\n");
+/*LOADS THE MATRIX IN CSR FORMAT: FROM THE BINARY CACHE (matrix.csr, NEXT TO THE .mtx) IF IT IS VALID, OTHERWISE THE .mtx IS PARSED
+  (SYMMETRIC MATRICES ARE EXPANDED, EXCEPT FOR --kernel=sym THAT KEEPS ONLY THE LOWER TRIANGLE), CONVERTED WITH A PARALLEL COUNTING SORT, AND THE CACHE IS WRITTEN FOR THE NEXT RUNS (SEE common/csr_cache.h)*/
+    CSRMatrix csr;
+    if(load_csr(filename, csr, opts.kernel == KERNEL_SYM) != 0)
         return 1;
-    }
 
-/*CATCH IF THE MATRIX IS SYMMETRIC (ONLY FIRST LINE). SKIPS THE COMMENTS AND READ THE FIRST LINE OF THE FILE, WHICH CONTAINS #ROWS, #COLUMNS, #NON ZERO VALUES*/
-    char line[1024];
-    fgets(line, sizeof(line), file);
-    int is_symmetric = strstr(line, "symmetric") != NULL;
-
-    do {
-        if (!fgets(line, sizeof(line), file)) {
-            fprintf(stderr,"[ERR] Empty file or error while reading\n");
-            fclose(file);
-            return 1;
-        }
-    } while (line[0] == '%');
-
-    int rows_number, columns_number, nnz;
-    sscanf(line, "%d %d %d", &rows_number, &columns_number, &nnz);
-    //printf("INFORMATION FROM FILE!!\nSymmetric:%d\nRows: %d\nColumns: %d\nNon zero values: %d\n\n",is_symmetric,rows_number, columns_number, nnz);
-
-    
-/*CREATES A LIST OF NODES WITH ALL THE NON ZERO ELEMENTS OF THE MATRIX AND EVENTUALLY ADAPTS TO ITS SYMMETRY*/
-
-    vector<Node> matrix;
-    //since I alredy know the actual size of the vector, I reserve some memory to speed up the allocation.
-    matrix.reserve(is_symmetric ? 2 * nnz : nnz);
-    
-    Node node;
-    int tmp_r, tmp_c;
-    for(int i=0; i<nnz; i++){
-        if(fgets(line, sizeof(line), file) == NULL){
-            fprintf(stderr, "[ERR] Something went wrong while reading the file (unexpected EOF at line %d)\n",i);
-            fclose(file);
-            return 1;
-        }
-        sscanf(line, "%d %d %lf", &node.row, &node.col, &node.value);
-        node.row--;
-        tmp_r=node.row;
-        node.col--;
-        tmp_c=node.col;
-        matrix.push_back(node);       
-
-        if(is_symmetric && tmp_r != tmp_c){
-            node.row = tmp_c;
-            node.col = tmp_r;
-            matrix.push_back(node);
-        }
-    }
+/*OPTIONAL REORDERING (--reorder=rcm): THE MATRIX IS RENUMBERED WITH REVERSE CUTHILL-McKEE, x IS PERMUTED IN THE SAME WAY AND THE RESULT IS
+  TAKEN BACK TO THE ORIGINAL ORDER AFTER THE TIMED REGION; BANDWIDTH, PROFILE AND REORDERING TIME ARE PRINTED ON stderr (SEE common/rcm.h)*/
+    Reordering reordering;
+    if(reorder_matrix(opts, csr, reordering) != 0)
+        return 1;
 
-/*SORTS THE ELEMENTS BASED FIRST ON ROWS AND EVENTUALLY ON  COLUMNS*/
-    sort(matrix.begin(), matrix.end(), [](const Node &a, const Node &b) {
-        if (a.row != b.row) return a.row < b.row;
-        return a.col < b.col;
-    });
+/*NUMA PLACEMENT (--placement=first-touch|interleave): THE CSR ARRAYS ARE COPIED INTO PAGES FIRST TOUCHED BY THE THREADS THAT COMPUTE THEIR ROWS,
+  x AND y ARE ZEROED BY THE SAME THREADS BEFORE BEING USED (SEE common/numa_placement.h). WITHOUT THE OPTION NOTHING CHANGES*/
+    NumaPlacement placement;
+    if(numa_place_csr(opts, csr, placement) != 0)
+        return 1;
 
-/*CREATION OF THE CSR REPRESENTATION*/
-    vector<int> rows_ptr ((rows_number+1), 0);
-    vector<int> cols;
-    vector<double> values;
+    int rows_number = csr.rows_number;
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    //printf("INFORMATION FROM FILE!!\nSymmetric:%d\nRows: %d\nColumns: %d\nNon zero values: %d\n\n",csr.is_symmetric,rows_number, csr.columns_number, csr.nnz);
 
-    if(is_symmetric){
-        cols.reserve(2*nnz);
-        values.reserve(2*nnz);
-    }
-    else{
-        cols.reserve(nnz);
-        values.reserve(nnz);
+/*CREATION OF A RANDOM ARRAY (WITH --vectors=k: k INTERLEAVED ARRAYS, ELEMENT i OF VECTOR j IS random_array[i*k + j])*/
+    PlacedVector random_array ((size_t)rows_number * opts.vectors);
+    numa_place_vector(placement, random_array.data(), rows_number, opts.vectors, 1);
+    for(size_t i = 0; i < random_array.size(); i++) {
+        random_array[i] = rand() % (9) + 1;
     }
+    permute_vector(reordering, random_array.data(), rows_number, opts.vectors);
 
-    for (const Node &n : matrix) {
-        cols.push_back(n.col);
-        values.push_back(n.value);
+/*MATRIX-ARRAY MULTIPLICATION*/
+    PlacedVector result ((size_t)rows_number * opts.vectors);
+    numa_place_vector(placement, result.data(), rows_number, opts.vectors, 0);
 
-        //Count of the values in each row
-        rows_ptr[n.row + 1]++;
-    }
+    //the storage format of the selected kernel (if it is not CSR) is built here, outside the timed region
+    SpmvKernel kernel;
+    if(prepare_kernel(opts, csr, kernel) != 0)
+        return 1;
+    numa_report(placement, csr, random_array.data(), result.data(), random_array.size());
+    kernel_report(kernel);
 
-    //using the offset in the array
-    for(int r=0; r<rows_number; r++)
-        rows_ptr[r+1] += rows_ptr[r];
+    //--prefetch-distance=sweep: GFLOP/s of the prefetch kernel for every distance instead of the single timed product
+    if(opts.kernel == KERNEL_PREFETCH && opts.prefetch_distance < 0){
+        prefetch_sweep(filename, csr, random_array.data(), result.data());
+        return 0;
+    }
 
-/*CREATION OF A RANDOM ARRAY*/
-    vector<double> random_array (rows_number);
-    for(int i = 0; i < rows_number; i++) {
-        random_array[i] = rand() % (9) + 1;
+    //--solver=cg: timed conjugate gradient on A*x = b with b = A*random_array instead of the single product (see common/cg.h)
+    if(opts.solver == SOLVER_CG){
+        cg_run(filename, opts, csr, random_array.data());
+        return 0;
     }
 
-/*MATRIX-ARRAY MULTIPLICATION*/
-    vector<double> result (rows_number, 0);
+    //--profile: per-thread rows, nonzeros, chunks, busy and barrier time of an instrumented copy of the loop below (see common/thread_profile.h)
+    if(opts.profile != PROFILE_OFF)
+        return profile_run(filename, opts, csr, random_array.data(), result.data());
+
+    //--perf-counters: one counter group per thread of the team, enabled only around the timed products (see common/perf_counters.h)
+    PerfCounters counters;
+    if(opts.perf_counters)
+        perf_counters_open(counters);
+
+    //--iterations=N: W untimed and N timed products, the output of every product is the input of the next one (see common/spmv_iterations.h).
+    //matrix:cpu time:real time:kernel:N:mean latency:min latency (and the error of the reduced precision on the last product, if any)
+    if(opts.iterations > 0){
+        IterationTimes times;
+        run_iterations(opts, kernel, random_array.data(), result.data(), times, &counters);
+        printf("%s:%.6f:%.6f:%s:%d:%.9f:%.9f", filename, times.cpu, times.real, kernel.label, times.iterations,
+               mean_latency(times), min_latency(times));
+        if(opts.precision != PRECISION_DOUBLE){
+            //the last product was result = A*random_array
+            vector<double> reference(rows_number);
+            spmv_csr(csr, random_array.data(), reference.data());
+            printf(":%.3e", max_relative_error(result.data(), reference.data(), rows_number));
+        }
+        printf("\n");
+        perf_counters_report(counters, filename, times.real);
+        //--roofline: the median product against the STREAM bandwidth of the same threads (see common/roofline.h)
+        if(opts.roofline)
+            kernel_roofline(filename, kernel, bench_stats(times.latency).median);
+        //--bench-output: median, percentiles, confidence interval, GFLOP/s and bandwidth of the N products (see common/bench_harness.h)
+        if(opts.bench_output && write_bench_record(opts, csr, kernel.label, times) != 0)
+            return 1;
+        return 0;
+    }
 
     //from here starts the real computation of the CSR and this is why the time of execution starts here
+    perf_counters_start(&counters);
     start2=clock();
     clock_gettime(CLOCK_MONOTONIC, &start);
 
-    #pragma omp parallel for schedule(static)
-    for(int r = 0; r < rows_number; r++){
-        for(int idx = rows_ptr[r]; idx < rows_ptr[r+1]; idx++){
-            result[r] += values[idx] * random_array[cols[idx]];
+    if(default_csr_loop(opts)){
+        #pragma omp parallel for schedule(static)
+        for(int r = 0; r < rows_number; r++){
+            for(int idx = rows_ptr[r]; idx < rows_ptr[r+1]; idx++){
+                result[r] += values[idx] * random_array[cols[idx]];
+            }
         }
     }
+    else
+        run_kernel(kernel, random_array.data(), result.data());
 
     //The execution finishes, this is why time stops here.
     clock_gettime(CLOCK_MONOTONIC, &end);
     end2=clock();
+    perf_counters_stop(&counters);
+
+    unpermute_vector(reordering, result.data(), rows_number, opts.vectors);
 
     //Print the resulting vector
     /*for(int r = 0; r < rows_number; r++)
@@ -152,8 +158,21 @@ int main(int argc, char* argv[]) {
 
     execution_time_REAL = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
     execution_time_CPU = static_cast<double>(end2 - start2)/CLOCKS_PER_SEC;
-    printf("%s:%.6f:%.6f\n", argv[1],execution_time_CPU, execution_time_REAL);
+    if(default_csr_loop(opts))
+        printf("%s:%.6f:%.6f\n", filename,execution_time_CPU, execution_time_REAL);
+    else if(opts.precision == PRECISION_DOUBLE)//the kernel is added as 4th field, so the default output stays the same
+        printf("%s:%.6f:%.6f:%s\n", filename,execution_time_CPU, execution_time_REAL, kernel.label);
+    else{
+        //reduced precision: the max relative error against the full double result is added as 5th field
+        vector<double> reference(rows_number);
+        spmv_csr(csr, random_array.data(), reference.data());
+        unpermute_vector(reordering, reference.data(), rows_number, 1);
+        printf("%s:%.6f:%.6f:%s:%.3e\n", filename,execution_time_CPU, execution_time_REAL, kernel.label,
+               max_relative_error(result.data(), reference.data(), rows_number));
+    }
+    perf_counters_report(counters, filename, execution_time_REAL);
+    if(opts.roofline)
+        kernel_roofline(filename, kernel, execution_time_REAL);
 
-    fclose(file);
     return 0;
 }
\ No newline at end of file
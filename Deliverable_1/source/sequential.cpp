@@ -6,14 +6,10 @@
 #include <random>
 #include <algorithm>
 #include <ctime>
+#include "../../common/csr_cache.h"
 
 using namespace std;
 
-struct Node {
-    int row, col;
-    double value;
-};
-
 int main(int argc, char* argv[]) {
     srand(time(NULL));
 
@@ -35,90 +31,17 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-/*OPENING THE FILE*/
-    FILE* file = fopen(argv[1], "r");
-    if (!file) {
-        fprintf(stderr,"[ERR] Error while opening the file\n");
+/*LOADS THE MATRIX IN CSR FORMAT: FROM THE BINARY CACHE (matrix.csr, NEXT TO THE .mtx) IF IT IS VALID, OTHERWISE THE .mtx IS PARSED
+  (SYMMETRIC MATRICES ARE EXPANDED), CONVERTED WITH A PARALLEL COUNTING SORT, AND THE CACHE IS WRITTEN FOR THE NEXT RUNS (SEE common/csr_cache.h)*/
+    CSRMatrix csr;
+    if(load_csr(filename, csr) != 0)
         return 1;
-    }
-
-/*CATCH IF THE MATRIX IS SYMMETRIC (ONLY FIRST LINE). SKIPS THE COMMENTS AND READ THE FIRST LINE OF THE FILE, WHICH CONTAINS #ROWS, #COLUMNS, #NON ZERO VALUES*/
-    char line[1024];
-    fgets(line, sizeof(line), file);
-    int is_symmetric = strstr(line, "symmetric") != NULL;
-
-    do {
-        if (!fgets(line, sizeof(line), file)) {
-            fprintf(stderr,"[ERR] Empty file or error while reading\n");
-            fclose(file);
-            return 1;
-        }
-    } while (line[0] == '%');
-
-    int rows_number, columns_number, nnz;
-    sscanf(line, "%d %d %d", &rows_number, &columns_number, &nnz);
-    //printf("INFORMATION FROM FILE!!\nSymmetric:%d\nRows: %d\nColumns: %d\nNon zero values: %d\n\n",is_symmetric,rows_number, columns_number, nnz);
-
-    
-/*CREATES A LIST OF NODES WITH ALL THE NON ZERO ELEMENTS OF THE MATRIX AND EVENTUALLY ADAPTS TO ITS SYMMETRY*/
-
-    vector<Node> matrix;
-    //since I alredy know the actual size of the vector, I reserve some memory to speed up the allocation.
-    matrix.reserve(is_symmetric ? 2 * nnz : nnz);
-    
-    Node node;
-    int tmp_r, tmp_c;
-    for(int i=0; i<nnz; i++){
-        if(fgets(line, sizeof(line), file) == NULL){
-            fprintf(stderr, "[ERR] Something went wrong while reading the file (unexpected EOF at line %d)\n",i);
-            fclose(file);
-            return 1;
-        }
-        sscanf(line, "%d %d %lf", &node.row, &node.col, &node.value);
-        node.row--;
-        tmp_r=node.row;
-        node.col--;
-        tmp_c=node.col;
-        matrix.push_back(node);       
-
-        if(is_symmetric && tmp_r != tmp_c){
-            node.row = tmp_c;
-            node.col = tmp_r;
-            matrix.push_back(node);
-        }
-    }
-
-/*SORTS THE ELEMENTS BASED FIRST ON ROWS AND EVENTUALLY ON  COLUMNS*/
-    sort(matrix.begin(), matrix.end(), [](const Node &a, const Node &b) {
-        if (a.row != b.row) return a.row < b.row;
-        return a.col < b.col;
-    });
-
-/*CREATION OF THE CSR REPRESENTATION*/
-    vector<int> rows_ptr ((rows_number+1), 0);
-    vector<int> cols;
-    vector<double> values;
-
-    if(is_symmetric){
-        cols.reserve(2*nnz);
-        values.reserve(2*nnz);
-    }
-    else{
-        cols.reserve(nnz);
-        values.reserve(nnz);
-    }
-
-    for (const Node &n : matrix) {
-        cols.push_back(n.col);
-        values.push_back(n.value);
-
-        //Count of the values in each row
-        rows_ptr[n.row + 1]++;
-    }
 
-    //using the offset in the array
-    for(int r=0; r<rows_number; r++)
-        rows_ptr[r+1] += rows_ptr[r];
+    int rows_number = csr.rows_number;
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    //printf("INFORMATION FROM FILE!!\nSymmetric:%d\nRows: %d\nColumns: %d\nNon zero values: %d\n\n",csr.is_symmetric,rows_number, csr.columns_number, csr.nnz);
 
 /*CREATION OF A RANDOM ARRAY*/
     vector<double> random_array (rows_number);
@@ -152,6 +75,5 @@ int main(int argc, char* argv[]) {
     execution_time_CPU = static_cast<double>(end2 - start2)/CLOCKS_PER_SEC;
     printf("%s:%.6f:%.6f\n", argv[1],execution_time_CPU, execution_time_REAL);
 
-    fclose(file);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <ctime>
+#include <string>
+#include <omp.h>
+#include "../../common/csr_cache.h"
+#include "../../common/spmv_kernels.h"
+#include "../../common/rcm.h"
+#include "../../common/cg.h"
+#include "../../common/spmv_iterations.h"
+#include "../../common/autotune.h"
+#include "../../common/thread_profile.h"
+#include "../../common/numa_placement.h"
+
+using namespace std;
+
+/*
+ * SINGLE SpMV ENGINE: SAME MEASUREMENT AS THE schedule*.cpp BINARIES, BUT THE KERNEL, THE SCHEDULE (KIND AND CHUNK)
+ * AND THE NUMBER OF THREADS ARE CHOSEN BY THE AUTO-TUNER OF common/autotune.h ON THE LOADED MATRIX (OR GIVEN WITH
+ * --kernel, --schedule, --threads). THE RESULT OF THE SEARCH IS SAVED IN THE TUNING CACHE, SO THE FOLLOWING RUNS ON
+ * THE SAME MATRIX SKIP IT.
+ */
+int main(int argc, char* argv[]) {
+    srand(time(NULL));
+
+    struct timespec start, end;
+    clock_t start2, end2;
+
+    double execution_time_CPU, execution_time_REAL;
+/*CHECK ON THE ARGUMENTS (THE FILE OF THE SPARSE MATRIX AND THE OPTIONAL FLAGS OF common/spmv_options.h, ENGINE ONES INCLUDED)*/
+    SpmvOptions opts;
+    if(parse_options(argc, argv, opts, 1) != 0)
+        return 1;
+    const char* filename = opts.matrix_path;
+    size_t len = strlen(filename);
+    size_t ext_len = 4; // Lunghezza di ".mtx"
+
+    if (len <= ext_len || strcmp(filename + len - ext_len, ".mtx") != 0) {
+        fprintf(stderr, "[ERR] Il file non ha l'estensione .mtx: %s\n", filename);
+        return 1;
+    }
+
+/*LOADS THE MATRIX IN CSR FORMAT (BINARY CACHE OR .mtx, SEE common/csr_cache.h)*/
+    CSRMatrix csr;
+    if(load_csr(filename, csr, opts.kernel == KERNEL_SYM) != 0)
+        return 1;
+
+/*OPTIONAL REORDERING (--reorder=rcm): THE MATRIX IS RENUMBERED WITH REVERSE CUTHILL-McKEE, x IS PERMUTED IN THE SAME WAY AND THE RESULT IS
+  TAKEN BACK TO THE ORIGINAL ORDER AFTER THE TIMED REGION; BANDWIDTH, PROFILE AND REORDERING TIME ARE PRINTED ON stderr (SEE common/rcm.h)*/
+    Reordering reordering;
+    if(reorder_matrix(opts, csr, reordering) != 0)
+        return 1;
+
+    int rows_number = csr.rows_number;
+
+/*CREATION OF A RANDOM ARRAY (WITH --vectors=k: k INTERLEAVED ARRAYS, ELEMENT i OF VECTOR j IS random_array[i*k + j])*/
+    vector<double> random_array ((size_t)rows_number * opts.vectors);
+    for(size_t i = 0; i < random_array.size(); i++) {
+        random_array[i] = rand() % (9) + 1;
+    }
+    permute_vector(reordering, random_array.data(), rows_number, opts.vectors);
+
+    vector<double> result ((size_t)rows_number * opts.vectors, 0);
+
+/*AUTO-TUNING (OUTSIDE THE TIMED REGION): CACHED CHOICE, OR SEARCH AND SAVE IT. THE CACHE IS ONLY USED FOR A FULL SEARCH*/
+    TuneChoice choice;
+    if(opts.tune == TUNE_OFF){
+        choice.kernel = opts.kernel >= 0 ? opts.kernel : KERNEL_CSR;
+        choice.schedule_kind = opts.schedule_kind >= 0 ? opts.schedule_kind : SCHEDULE_STATIC;
+        choice.schedule_chunk = opts.schedule_kind >= 0 ? opts.schedule_chunk : 0;
+        choice.threads = opts.threads > 0 ? opts.threads : omp_get_max_threads();
+        choice.seconds = 0.0;
+    }
+    else{
+        int full_search = opts.kernel < 0 && opts.schedule_kind < 0 && opts.threads == 0;
+        string cache_path = full_search ? tune_cache_path(filename) : string();
+        string key = cache_path.empty() ? string() : tune_fingerprint(csr, opts);
+
+        if(cache_path.empty() || opts.tune == TUNE_FORCE || tune_cache_lookup(cache_path, key, choice) != 0){
+            choice = autotune(opts, csr, random_array.data(), result.data());
+            if(!cache_path.empty() && choice.seconds < TUNE_FAILED && tune_cache_store(cache_path, key, choice) != 0)
+                fprintf(stderr, "[ERR] Could not write the tuning cache %s\n", cache_path.c_str());
+        }
+    }
+
+    apply_choice(choice);
+    opts.kernel = choice.kernel;
+
+/*NUMA PLACEMENT (--placement=first-touch|interleave) WITH THE ROWS OF THE CHOSEN KERNEL, SCHEDULE AND THREADS: THE CSR ARRAYS AND THE
+  VECTORS USED BY THE TUNING TRIALS ARE COPIED BY THE THREADS THAT COMPUTE THEIR ROWS (SEE common/numa_placement.h)*/
+    NumaPlacement placement;
+    if(numa_place_csr(opts, csr, placement) != 0)
+        return 1;
+    PlacedVector x ((size_t)rows_number * opts.vectors), y ((size_t)rows_number * opts.vectors);
+    numa_place_vector(placement, x.data(), rows_number, opts.vectors, 1, random_array.data());
+    numa_place_vector(placement, y.data(), rows_number, opts.vectors, 0);
+    vector<double>().swap(random_array);
+    vector<double>().swap(result);
+
+    //the storage format of the chosen kernel is built here, outside the timed region
+    SpmvKernel kernel;
+    if(prepare_kernel(opts, csr, kernel) != 0)
+        return 1;
+    numa_report(placement, csr, x.data(), y.data(), x.size());
+    kernel_report(kernel);
+
+    //--prefetch-distance=sweep: GFLOP/s of the prefetch kernel for every distance instead of the single timed product
+    if(opts.kernel == KERNEL_PREFETCH && opts.prefetch_distance < 0){
+        prefetch_sweep(filename, csr, x.data(), y.data());
+        return 0;
+    }
+
+    //--solver=cg: timed conjugate gradient on A*x = b with b = A*random_array instead of the single product (see common/cg.h)
+    if(opts.solver == SOLVER_CG){
+        cg_run(filename, opts, csr, x.data());
+        return 0;
+    }
+
+    //--profile: per-thread profile of the csr loop with the chosen threads and schedule, or with every schedule (see common/thread_profile.h)
+    if(opts.profile != PROFILE_OFF)
+        return profile_run(filename, opts, csr, x.data(), y.data());
+
+    //--perf-counters: one counter group per thread of the chosen team, enabled only around the timed products (see common/perf_counters.h)
+    PerfCounters counters;
+    if(opts.perf_counters)
+        perf_counters_open(counters);
+
+    //--iterations=N: W untimed and N timed products, y fed back as x (see common/spmv_iterations.h).
+    //matrix:cpu time:real time:kernel:schedule,chunk:threads:N:mean latency:min latency (and the error of the reduced precision, if any)
+    if(opts.iterations > 0){
+        IterationTimes times;
+        run_iterations(opts, kernel, x.data(), y.data(), times, &counters);
+        printf("%s:%.6f:%.6f:%s:%s,%d:%d:%d:%.9f:%.9f", filename, times.cpu, times.real, kernel.label,
+               schedule_names[choice.schedule_kind], choice.schedule_chunk, choice.threads, times.iterations,
+               mean_latency(times), min_latency(times));
+        if(opts.precision != PRECISION_DOUBLE){
+            //the last product was y = A*x
+            vector<double> reference(rows_number);
+            spmv_csr(csr, x.data(), reference.data());
+            printf(":%.3e", max_relative_error(y.data(), reference.data(), rows_number));
+        }
+        printf("\n");
+        perf_counters_report(counters, filename, times.real);
+        //--roofline: the median product against the STREAM bandwidth of the same threads (see common/roofline.h)
+        if(opts.roofline)
+            kernel_roofline(filename, kernel, bench_stats(times.latency).median);
+        //--bench-output: median, percentiles, confidence interval, GFLOP/s and bandwidth of the N products (see common/bench_harness.h)
+        if(opts.bench_output && write_bench_record(opts, csr, kernel.label, times) != 0)
+            return 1;
+        return 0;
+    }
+
+    //from here starts the real computation and this is why the time of execution starts here
+    perf_counters_start(&counters);
+    start2=clock();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    run_kernel(kernel, x.data(), y.data());
+
+    //The execution finishes, this is why time stops here.
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end2=clock();
+    perf_counters_stop(&counters);
+
+    unpermute_vector(reordering, y.data(), rows_number, opts.vectors);
+
+    execution_time_REAL = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    execution_time_CPU = static_cast<double>(end2 - start2)/CLOCKS_PER_SEC;
+
+    //matrix:cpu time:real time:kernel:schedule,chunk:threads (and the error of the reduced precision, if any)
+    if(opts.precision == PRECISION_DOUBLE)
+        printf("%s:%.6f:%.6f:%s:%s,%d:%d\n", filename, execution_time_CPU, execution_time_REAL, kernel.label,
+               schedule_names[choice.schedule_kind], choice.schedule_chunk, choice.threads);
+    else{
+        vector<double> reference(rows_number);
+        spmv_csr(csr, x.data(), reference.data());
+        unpermute_vector(reordering, reference.data(), rows_number, 1);
+        printf("%s:%.6f:%.6f:%s:%s,%d:%d:%.3e\n", filename, execution_time_CPU, execution_time_REAL, kernel.label,
+               schedule_names[choice.schedule_kind], choice.schedule_chunk, choice.threads,
+               max_relative_error(y.data(), reference.data(), rows_number));
+    }
+    perf_counters_report(counters, filename, execution_time_REAL);
+    if(opts.roofline)
+        kernel_roofline(filename, kernel, execution_time_REAL);
+
+    return 0;
+}
@@ -7,29 +7,58 @@
 #include <random>
 #include <algorithm>
 #include <ctime>
-
-#define BUFFER_SIZE 50000  //necessary for NOT exceeding the memory size
+#include "../../common/mtx_parser.h"
+#include "../../common/spmv_options.h"
+#include "../../common/spmm.h"
+#include "../../common/cg.h"
+#include "../../common/bench_harness.h"
+#include "../../common/roofline.h"
+
+#define READ_BLOCK_SIZE (64*1024*1024)  //bytes read by each process in every collective call: bounds the memory used for the text
 #define NUM_ITERATIONS 10
 
 using namespace std;
 
-struct Node {
-    int row, col;
-    double value;
-};
-
-//FUNCTION USED BY RANK_0 FOR SENDING VALUES TO DIFFERENT PROCESSES
-void flush_buffer(int dest, vector<vector<int>>& rows, vector<vector<int>>& cols, vector<vector<double>>& vals) {
-    int count = rows[dest].size();
-    if (count > 0) {
-        MPI_Send(&count, 1, MPI_INT, dest, 0, MPI_COMM_WORLD);
-        MPI_Send(rows[dest].data(), count, MPI_INT, dest, 1, MPI_COMM_WORLD);
-        MPI_Send(cols[dest].data(), count, MPI_INT, dest, 2, MPI_COMM_WORLD);
-        MPI_Send(vals[dest].data(), count, MPI_DOUBLE, dest, 3, MPI_COMM_WORLD);
-        
-        rows[dest].clear();
-        cols[dest].clear();
-        vals[dest].clear();
+/*PARSES THE COMPLETE LINES IN [p, end) AND INSERTS EVERY ENTRY (AND ITS SYMMETRIC ONE) INTO THE SEND BUFFER OF THE PROCESS THAT OWNS ITS ROW.
+  ENTRIES OUTSIDE THE rows_number x columns_number MATRIX ARE COUNTED AS MALFORMED (SAME CHECK AS mtx_load) AND NOT SENT*/
+int parse_lines(const char* p, const char* end, int is_symmetric, int is_pattern, int rows_number, int columns_number,
+                vector<vector<Node>>& outgoing, long long& parsed) {
+    int num_proc = outgoing.size();
+    int malformed = 0;
+    Node entry;
+
+    while (p < end) {
+        int ret = mtx_parse_entry(p, end, entry, is_pattern);
+        if (ret < 0) malformed++;
+        if (ret != 1) continue;
+        parsed++;
+        if (entry.row < 0 || entry.row >= rows_number || entry.col < 0 || entry.col >= columns_number) {
+            malformed++;
+            continue;
+        }
+
+        outgoing[entry.row % num_proc].push_back(entry);//THE DESTINATION CAN RANGE FROM 0 TO N-1
+
+        if (is_symmetric && entry.row != entry.col) {//IF THE MATRIX IS SYMMETRIC, ANOTHER ELEMENT HAS TO BE INSERT BUT IT MAY BELONG TO A DIFFERENT PROCESS
+            double value = (is_symmetric == MTX_SKEW_SYMMETRIC) ? -entry.value : entry.value;
+            outgoing[entry.col % num_proc].push_back(Node(entry.col, entry.row, value));
+        }
+    }
+    return malformed;
+}
+
+/*LOCAL SpMV ON THE ROWS OF THE PROCESS: VT (VALUES) AND XT (x) ARE double OR float, THE SUM IS ALWAYS IN double*/
+template <typename VT, typename XT>
+void local_spmv(int local_rows, const vector<int>& row_ptr, const vector<int>& col_ind, const vector<VT>& values, const vector<XT>& x, vector<double>& y) {
+    for(int i = 0; i < local_rows; i++) {
+        double dot_product = 0.0;
+        int start_idx = row_ptr[i];
+        int end_idx   = row_ptr[i+1];
+
+        for(int k = start_idx; k < end_idx; k++) {
+            dot_product += (double)values[k] * (double)x[col_ind[k]];
+        }
+        y[i] = dot_product;
     }
 }
 
@@ -44,55 +73,133 @@ int main (int argc, char *argv[]){
     int rows_number=0;
     int columns_number=0;
     int nnz=0;
-
-    vector<double> values;
-    vector<int> rows;
-    vector<int> cols;
-
-    FILE* file = NULL;
-    char line[1024];
+    int is_pattern=0;
+    long long body_offset=0;//FIRST BYTE AFTER THE HEADER
 
     double start, end, max_exec_time;
     double flops;
 
-/*RANK_0 CHECKS PARAMETERS, READS THE HEADER OF THE FILE AND SHARES BASIC INFORMATION ABOUT THE MATRIX WITH OTHER PROCESSES */
-    if(my_rank == 0){
+/*EVERY PROCESS CHECKS THE PARAMETERS (ONLY RANK_0 PRINTS), THEN THE FILE IS OPENED BY ALL THE PROCESSES WITH MPI-IO*/
+    if(my_rank == 0)
         srand(time(NULL));
 
-        /*CHECK ON THE ARGUMENT (THE FILE OF THE SPARSE MATRIX)*/
-        if(argc != 2){
+    /*CHECK ON THE ARGUMENTS (THE FILE OF THE SPARSE MATRIX AND THE OPTIONAL --precision=double|float|float-x, --vectors=k, --solver=spmv|cg)*/
+    char* filename = NULL;
+    int precision = PRECISION_DOUBLE;//STORAGE OF THE VALUES (float) AND OF x (float-x), THE ACCUMULATION IS ALWAYS IN double
+    int vectors = 1;//NUMBER OF DENSE VECTORS MULTIPLIED AT ONCE (SpMM ON AN INTERLEAVED BLOCK)
+    int solver = SOLVER_SPMV;//TIMED OPERATION: NUM_ITERATIONS PRODUCTS OR THE CONJUGATE GRADIENT SOLVER
+    int cg_iterations = 1000;
+    double cg_tolerance = 1e-8;
+    int iterations = NUM_ITERATIONS;//TIMED PRODUCTS
+    int warmup = 0;//UNTIMED PRODUCTS BEFORE THEM
+    const char* bench_output = NULL;//FILE OF THE BENCHMARK RECORD (SEE common/bench_harness.h)
+    int roofline = 0;//STREAM BANDWIDTH OF ALL THE RANKS AND ACHIEVED AGAINST ATTAINABLE GFLOPS (SEE common/roofline.h)
+    int wrong_arguments = 0;
+    int quiet = (my_rank != 0);
+    for(int i = 1; i < argc; i++){
+        const char* v;
+        if((v = option_value(argv[i], "--precision"))){
+            precision = parse_precision(v);
+            if(precision < 0) wrong_arguments = 1;
+        }
+        else if((v = option_value(argv[i], "--vectors"))){
+            //SAME STRICT CONVERSIONS AND MESSAGES OF THE OpenMP BINARIES (common/spmv_options.h), PRINTED ONLY BY RANK_0
+            if(parse_int_option(v, "--vectors", vectors, quiet) || vectors < 1 || vectors > SPMM_MAX_VECTORS){
+                if(!quiet) fprintf(stderr, "[ERR] --vectors must be between 1 and %d\n", SPMM_MAX_VECTORS);
+                wrong_arguments = 1;
+            }
+        }
+        else if((v = option_value(argv[i], "--solver"))){
+            solver = strcmp(v, "cg") == 0 ? SOLVER_CG : (strcmp(v, "spmv") == 0 ? SOLVER_SPMV : -1);
+            if(solver < 0) wrong_arguments = 1;
+        }
+        else if((v = option_value(argv[i], "--cg-iterations"))){
+            if(parse_int_option(v, "--cg-iterations", cg_iterations, quiet) || cg_iterations < 1){
+                if(!quiet) fprintf(stderr, "[ERR] --cg-iterations must be a positive number\n");
+                wrong_arguments = 1;
+            }
+        }
+        else if((v = option_value(argv[i], "--cg-tolerance"))){
+            if(parse_double_option(v, "--cg-tolerance", cg_tolerance, quiet) || cg_tolerance < 0.0){
+                if(!quiet) fprintf(stderr, "[ERR] --cg-tolerance must be a number >= 0: %s\n", v);
+                wrong_arguments = 1;
+            }
+        }
+        else if((v = option_value(argv[i], "--iterations"))){
+            if(parse_int_option(v, "--iterations", iterations, quiet) || iterations < 1){
+                if(!quiet) fprintf(stderr, "[ERR] --iterations must be a positive number\n");
+                wrong_arguments = 1;
+            }
+        }
+        else if((v = option_value(argv[i], "--warmup"))){
+            if(parse_int_option(v, "--warmup", warmup, quiet) || warmup < 0){
+                if(!quiet) fprintf(stderr, "[ERR] --warmup must be a number >= 0\n");
+                wrong_arguments = 1;
+            }
+        }
+        else if((v = option_value(argv[i], "--bench-output"))){
+            bench_output = v;
+            if(*v == '\0') wrong_arguments = 1;
+        }
+        else if(strcmp(argv[i], "--roofline") == 0)
+            roofline = 1;
+        else if(strncmp(argv[i], "--", 2) != 0 && filename == NULL)
+            filename = argv[i];
+        else
+            wrong_arguments = 1;
+    }
+    if(vectors > 1 && precision != PRECISION_DOUBLE) wrong_arguments = 1;//SpMM ONLY IN DOUBLE PRECISION
+    if(solver == SOLVER_CG && (vectors > 1 || precision != PRECISION_DOUBLE || roofline)) wrong_arguments = 1;//CG ON ONE VECTOR IN DOUBLE PRECISION
+    if(filename == NULL || wrong_arguments){
+        if(my_rank == 0){
             fprintf(stderr,"[ERR] Missing argument (or extra argument added) when executing the file\n");
-            MPI_Abort(MPI_COMM_WORLD,1);
+            fprintf(stderr,"Usage: %s <matrix.mtx> [--precision=double|float|float-x | --vectors=1..32 | --solver=cg [--cg-tolerance=t] [--cg-iterations=N]]"
+                           " [--iterations=N] [--warmup=W] [--bench-output=FILE] [--roofline]\n", argv[0]);
         }
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
 
-        char* filename = argv[1];
-        size_t len = strlen(filename);
-        size_t ext_len = 4; // Lunghezza di ".mtx"
-        if (len <= ext_len || strcmp(filename + len - ext_len, ".mtx") != 0) {
-            fprintf(stderr, "[ERR] File foesn't have .mtx extension: %s\n", filename);
-            MPI_Abort(MPI_COMM_WORLD,1);
-        }
+    size_t len = strlen(filename);
+    size_t ext_len = 4; // Lunghezza di ".mtx"
+    if (len <= ext_len || strcmp(filename + len - ext_len, ".mtx") != 0) {
+        if(my_rank == 0) fprintf(stderr, "[ERR] File foesn't have .mtx extension: %s\n", filename);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
 
-        /*OPENING THE FILE*/
-        file = fopen(argv[1], "r");
-        if (!file) {
-            fprintf(stderr,"[ERR] Error while opening the file\n");
-            MPI_Abort(MPI_COMM_WORLD,1);
+    /*OPENING THE FILE (COLLECTIVE)*/
+    MPI_File fh;
+    if (MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if(my_rank == 0) fprintf(stderr,"[ERR] Error while opening the file\n");
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+    MPI_Offset file_size;
+    MPI_File_get_size(fh, &file_size);
+
+/*RANK_0 READS THE HEADER OF THE FILE AND SHARES BASIC INFORMATION ABOUT THE MATRIX WITH OTHER PROCESSES*/
+    if(my_rank == 0){
+        /*READS THE BEGINNING OF THE FILE UNTIL IT CONTAINS THE WHOLE HEADER (BANNER, COMMENTS AND SIZE LINE)*/
+        vector<char> head;
+        MPI_Offset probe = 65536;
+        while(1){
+            if (probe > file_size) probe = file_size;
+            head.resize(probe);
+            MPI_File_read_at(fh, 0, head.data(), (int)probe, MPI_CHAR, MPI_STATUS_IGNORE);
+            if (mtx_header_complete(head.data(), probe) || probe == file_size) break;
+            probe *= 2;
         }
 
         /*CATCH IF THE MATRIX IS SYMMETRIC (ONLY FIRST LINE). SKIPS THE COMMENTS AND READ THE FIRST LINE OF THE FILE, WHICH CONTAINS #ROWS, #COLUMNS, #NON ZERO VALUES*/
-        fgets(line, sizeof(line), file);
-        is_symmetric = strstr(line, "symmetric") != NULL;
-
-        do {
-            if (!fgets(line, sizeof(line), file)) {
-                fprintf(stderr,"[ERR] Empty file or error while reading\n");
-                fclose(file);
-                MPI_Abort(MPI_COMM_WORLD,1);
-            }
-        } while (line[0] == '%');
+        MtxHeader header;
+        size_t offset = 0;
+        if (mtx_parse_header(head.data(), probe, header, offset) != 0)
+            MPI_Abort(MPI_COMM_WORLD,1);
 
-        sscanf(line, "%d %d %d", &rows_number, &columns_number, &nnz);
+        is_symmetric = header.is_symmetric;
+        is_pattern = header.is_pattern;
+        rows_number = header.rows_number;
+        columns_number = header.columns_number;
+        nnz = header.nnz;
+        body_offset = offset;
     }
 
     /*RANK_0 SHARES MAIN INFORMATION OF THE MATRIX TO OTHER PROCESSES*/
@@ -100,117 +207,132 @@ int main (int argc, char *argv[]){
     MPI_Bcast(&columns_number, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&nnz,  1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&is_symmetric, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-/*RANK_0 READS THE WHOLE FILE AND SENDS TO OTHER PROCESSES THE ROWS THAT BELONG TO THEM. SEND OPERATION ARE PERFORMED EVERY 50000 ELEMENTS*/
-    if (my_rank == 0){
-        vector<vector<double>> buffer_values(num_proc);
-        vector<vector<int>> buffer_rows(num_proc);
-        vector<vector<int>> buffer_cols(num_proc);
-
-        int tmp_row, tmp_col, dest;
-        double tmp_val;
-
-        /*RANK_0 READS EACH LINE OF THE FILE AND INSERTS VALUES INTO THE BUFFER OF THE AIMED PROCESS (dest)*/
-        for(int i=0; i<nnz; i++){
-            if(fgets(line, sizeof(line), file) == NULL){
-                fprintf(stderr, "[ERR] Something went wrong while reading the file (unexpected EOF at line %d)\n",i);
-                fclose(file);
-                return 1;
+    MPI_Bcast(&is_pattern, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&body_offset, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+/*EVERY PROCESS READS ITS OWN BYTE RANGE OF THE BODY WITH MPI_File_read_at_all AND PARSES IT LOCALLY.
+  A PROCESS OWNS THE LINES THAT START INSIDE ITS RANGE: THE PARTIAL LINE AT THE BEGINNING IS SKIPPED (IT BELONGS TO THE PREVIOUS PROCESS)
+  AND THE LAST LINE IS COMPLETED BY READING PAST THE END OF THE RANGE*/
+    long long body_len = file_size - body_offset;
+    long long range_start = body_offset + body_len * my_rank / num_proc;
+    long long range_end = body_offset + body_len * (my_rank + 1) / num_proc;
+
+    //ranks > 0 start one byte earlier: if that byte is '\n', the range begins exactly at the start of a line
+    long long read_pos = (my_rank == 0) ? range_start : range_start - 1;
+    int skipping_head = (my_rank != 0);
+
+    //all the ranges have (almost) the same length, so every process performs the same number of collective reads
+    long long max_range = body_len / num_proc + 2;
+    int rounds = (int)((max_range + READ_BLOCK_SIZE - 1) / READ_BLOCK_SIZE);
+
+    vector<vector<Node>> outgoing(num_proc);//ENTRIES FOR EACH DESTINATION PROCESS
+    vector<char> buffer;
+    size_t pending = 0;//BYTES OF A LINE NOT COMPLETED YET, KEPT AT THE BEGINNING OF THE BUFFER
+    long long parsed = 0;
+    int malformed = 0;
+
+    for(int round = 0; round < rounds; round++){
+        int count = (int)min((long long)READ_BLOCK_SIZE, max(0LL, range_end - read_pos));
+        buffer.resize(pending + count);
+
+        MPI_Status status;
+        MPI_File_read_at_all(fh, read_pos, buffer.data() + pending, count, MPI_CHAR, &status);
+        read_pos += count;
+
+        const char* p = buffer.data();
+        const char* data_end = buffer.data() + pending + count;
+
+        if (skipping_head) {//SKIPS THE END OF THE LINE STARTED IN THE PREVIOUS RANGE
+            const char* nl = (const char*)memchr(p, '\n', data_end - p);
+            if (!nl) {
+                pending = 0;
+                continue;
             }
-            sscanf(line, "%d %d %lf", &tmp_row, &tmp_col, &tmp_val);
-            tmp_row--;
-            tmp_col--;
+            p = nl + 1;
+            skipping_head = 0;
+        }
 
-            dest = tmp_row % num_proc;//THE DESTINATION CAN RANGE FROM 0 (THIS PROCESS) TO N-1
+        //only complete lines are parsed, the last partial one waits for the next block
+        const char* last_nl = p;
+        for (const char* q = data_end; q > p; q--)
+            if (q[-1] == '\n') { last_nl = q; break; }
 
-            if (dest == 0){//ALREADY THERE, NO NEED FOR BUFFER
-                values.push_back(tmp_val);
-                rows.push_back(tmp_row);
-                cols.push_back(tmp_col);
-            }
-            else{//IF DESTINATION != RANK_0, ROW, COLUMN AND VALUE ARE INSERT INTO THE BUFFER OF THE DESTINATION
-                buffer_rows[dest].push_back(tmp_row);
-                buffer_cols[dest].push_back(tmp_col);
-                buffer_values[dest].push_back(tmp_val);
-
-                if (buffer_rows[dest].size() >= BUFFER_SIZE) {//WHEN THE DESTINATION BUFFER REACHES BUFFER_SIZE, THE FUNCTION IS CALLED AND THE BUFFER GETS FREED
-                        flush_buffer(dest, buffer_rows, buffer_cols, buffer_values);
-                    }
-            }
+        malformed += parse_lines(p, last_nl, is_symmetric, is_pattern, rows_number, columns_number, outgoing, parsed);
 
-            if(is_symmetric && tmp_row != tmp_col){//IF THE MATRIX IS SYMMETRIC, ANOTHER ELEMENT HAS TO BE INSERT BUT IT WILL BELONG TO A DIFFERENT PROCESS
-                dest = tmp_col % num_proc;
-
-                if(dest == 0){
-                    values.push_back(tmp_val);
-                    rows.push_back(tmp_col);
-                    cols.push_back(tmp_row);
-                }
-                else{
-                    buffer_rows[dest].push_back(tmp_col);
-                    buffer_cols[dest].push_back(tmp_row);
-                    buffer_values[dest].push_back(tmp_val);
-
-                    if (buffer_rows[dest].size() >= BUFFER_SIZE) {
-                        flush_buffer(dest, buffer_rows, buffer_cols, buffer_values);
-                    }
-                }
+        pending = data_end - last_nl;
+        memmove(buffer.data(), last_nl, pending);
+    }
+
+    /*FIX-UP OF THE LINE CROSSING THE END OF THE RANGE: IT IS COMPLETED WITH INDEPENDENT READS UNTIL THE NEXT NEWLINE*/
+    if (!skipping_head && pending > 0) {
+        char tail[4096];
+        int done = 0;
+        buffer.resize(pending);
+        while (!done && read_pos < file_size) {
+            int count = (int)min((MPI_Offset)sizeof(tail), file_size - read_pos);
+            MPI_File_read_at(fh, read_pos, tail, count, MPI_CHAR, MPI_STATUS_IGNORE);
+            read_pos += count;
+
+            const char* nl = (const char*)memchr(tail, '\n', count);
+            if (nl) {
+                count = nl - tail + 1;
+                done = 1;
             }
+            buffer.insert(buffer.end(), tail, tail + count);
         }
+        malformed += parse_lines(buffer.data(), buffer.data() + buffer.size(), is_symmetric, is_pattern, rows_number, columns_number, outgoing, parsed);
+    }
+    vector<char>().swap(buffer);
+
+    MPI_File_close(&fh);
+
+    /*CHECKS THAT THE PROCESSES READ EXACTLY THE ENTRIES DECLARED IN THE HEADER (EXTRA ENTRY LINES ARE AN ERROR, AS IN mtx_load) AND ALL INSIDE THE MATRIX*/
+    long long total_parsed = 0;
+    int total_malformed = 0;
+    MPI_Allreduce(&parsed, &total_parsed, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(&malformed, &total_malformed, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (total_malformed > 0 || total_parsed != nnz) {
+        if(my_rank == 0) fprintf(stderr, "[ERR] Something went wrong while reading the file (%lld entries of %d, %d malformed or out of range)\n", total_parsed, nnz, total_malformed);
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
 
-        fclose(file);
+/*ENTRIES ARE REDISTRIBUTED TO THE PROCESSES THAT OWN THEIR ROWS WITH A SINGLE MPI_Alltoallv*/
+    /*A NODE IS SENT AS A BLOCK OF BYTES: COUNTS ARE IN NODES, SO THEY DON'T OVERFLOW AN int EVEN WITH A FEW PROCESSES*/
+    MPI_Datatype node_type;
+    MPI_Type_contiguous(sizeof(Node), MPI_BYTE, &node_type);
+    MPI_Type_commit(&node_type);
 
-        /*WHEN REACHING EOF, THE FUNCTION IS CALLED: ELEMENTS ARE SENT TO THE PROCESSES AND BUFFERS OF ALL PROCESSES ARE RELEASED*/
-        for(int p=1; p<num_proc; p++){
-            flush_buffer(p, buffer_rows, buffer_cols, buffer_values);
-            
-            /*RECEIVING VALUE 0 WILL TERMINATE A while(1) CYCLE INTO THE RECEIVING PROCESSES*/
-            int stop = 0;
-            MPI_Send(&stop, 1, MPI_INT, p, 0, MPI_COMM_WORLD);
-        }
+    vector<int> send_nodes(num_proc), recv_nodes(num_proc);
+    vector<int> send_displs(num_proc, 0), recv_displs(num_proc, 0);
+    for(int p = 0; p < num_proc; p++)
+        send_nodes[p] = outgoing[p].size();
+
+    MPI_Alltoall(send_nodes.data(), 1, MPI_INT, recv_nodes.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+    for(int p = 1; p < num_proc; p++){
+        send_displs[p] = send_displs[p-1] + send_nodes[p-1];
+        recv_displs[p] = recv_displs[p-1] + recv_nodes[p-1];
     }
 
-/*OTHER PROCESSES RECEIVE ROWS SENT BY RANK_0. THE RECEIVING CYCLE IS TERMINATED BY A 0 VALUE*/
-    else{
-        while(1) {
-            int count;
-            /*FIRST RECEIVES HOW MANY ELEMENTS WILL ARRIVE*/
-            MPI_Recv(&count, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            
-            /*IF ZERO ELEMENTS, STOP WAITING SINCE ALL THE ELEMENTS HAVE BEEN RECEIVED*/
-            if (count == 0) break;
-
-            /*IN ORDER TO AVOID HAVING TEMPORARY BUFFERS FOR THE ARRIVING ELEMENTS, ALL OF THEM ARE DIRECTLY INSERT INTO FINAL VECTORS*/
-            size_t start_idx = rows.size();//NEED TO RESIZE THE VECTOR AND "MAKING SPACE" FOR NEW ARRIVALS
-            rows.resize(start_idx + count);
-            cols.resize(start_idx + count);
-            values.resize(start_idx + count);
-
-            /*ARRIVING ELEMENTS ARE INSERT INTO THE POSITION AFTER THE LAST ELEMENT rows.data() + start_idx*/
-            MPI_Recv(rows.data() + start_idx, count, MPI_INT, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(cols.data() + start_idx, count, MPI_INT, 0, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(values.data() + start_idx, count, MPI_DOUBLE, 0, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
+    /*SEND BUFFERS ARE PACKED INTO A SINGLE CONTIGUOUS ONE (EACH ONE IS RELEASED AS SOON AS IT IS COPIED)*/
+    vector<Node> send_buffer(send_displs[num_proc-1] + send_nodes[num_proc-1]);
+    for(int p = 0; p < num_proc; p++){
+        copy(outgoing[p].begin(), outgoing[p].end(), send_buffer.begin() + send_displs[p]);
+        vector<Node>().swap(outgoing[p]);
     }
 
+    vector<Node> elements(recv_displs[num_proc-1] + recv_nodes[num_proc-1]);
+    MPI_Alltoallv(send_buffer.data(), send_nodes.data(), send_displs.data(), node_type,
+                  elements.data(), recv_nodes.data(), recv_displs.data(), node_type, MPI_COMM_WORLD);
+
+    /*RELEASE MEMORY (AVOIDS OUT-OF-MEMORY SITUATIONS)*/
+    vector<Node>().swap(send_buffer);
+    MPI_Type_free(&node_type);
+
 /*ELEMENTS OF EACH PROCESS ARE SORTED AND REPRESENTED IN CSR FORMAT (COMMON TO ALL PROCESSES)*/
     /*WAIT FOR EVERY PROCESS TO FINISH I/O OPERATION*/
     MPI_Barrier(MPI_COMM_WORLD);
 
-    /*TO SIMPLIFY THE SORTING OPERATION (AND THE CSR REPRESENTATION), NEED TO CREATE A VECTOR OF NODES*/
-    size_t n_elements = rows.size();
-    vector<Node> elements(n_elements);
-
-    for(size_t i = 0; i < n_elements; i++) {
-        elements[i].row = rows[i];
-        elements[i].col = cols[i];
-        elements[i].value = values[i];
-    }
-    /*RELEASE MEMORY (AVOIDS OUT-OF-MEMORY SITUATIONS)*/
-    rows.clear(); rows.shrink_to_fit();
-    cols.clear(); cols.shrink_to_fit();
-    values.clear(); values.shrink_to_fit();
-
     /*SORTING*/
     sort(elements.begin(), elements.end(), [](const Node &a, const Node &b) {
         if (a.row != b.row) return a.row < b.row;
@@ -247,10 +369,13 @@ int main (int argc, char *argv[]){
     int local_array_size = columns_number / num_proc; 
     if (my_rank < (columns_number % num_proc)) local_array_size++;
 
-    vector<double> local_array(local_array_size);//DENSE VECTOR FOR THE SpMV
-    vector<double> local_result(max_local_rows, 0.0);
+    //WITH k VECTORS THE k VALUES OF EVERY ELEMENT ARE CONTIGUOUS (ELEMENT i OF VECTOR j IS AT i*k + j), THE SAME FOR THE RESULT
+    int local_x_values = local_array_size * vectors;
+
+    vector<double> local_array(local_x_values);//DENSE VECTOR FOR THE SpMV
+    vector<double> local_result((size_t)max_local_rows * vectors, 0.0);
 
-    for(int i=0; i<local_array_size; i++) {
+    for(int i=0; i<local_x_values; i++) {
         local_array[i] = rand() % 9+1;
     }
     
@@ -265,68 +390,241 @@ int main (int argc, char *argv[]){
         displs[i] = displs[i-1] + recv_counts[i-1];
     }
 
-    vector<double> global_array(columns_number);//CONTAINS THE GLOBAL VECTOR
+    //EVERY ELEMENT CARRIES k VALUES: THE BLOCK OF A PROCESS IS STILL CONTIGUOUS IN THE GLOBAL ARRAY
+    for(int i = 0; i < num_proc; i++) {
+        recv_counts[i] *= vectors;
+        displs[i] *= vectors;
+    }
+
+    vector<double> global_array((size_t)columns_number * vectors);//CONTAINS THE GLOBAL VECTOR
+    long long local_nnz_count = csr_col_ind.size();
+
+/*--solver=cg: CONJUGATE GRADIENT ON A*x = b WITH b = A*x_true, x_true = THE RANDOM VECTOR (SEE common/cg.h), INSTEAD OF THE PRODUCTS.
+  THE VECTORS FOLLOW THE ROWS: LOCAL ELEMENT i IS GLOBAL ROW my_rank + i*num_proc, SO THE UPDATES OF x, r AND p ARE LOCAL.
+  p IS GATHERED WITH THE SAME MPI_Allgatherv OF THE SpMV (BLOCK OF RANK q AT displs[q]), SO GLOBAL COLUMN c IS AT
+  displs[c % num_proc] + c / num_proc: THE COLUMNS ARE REMAPPED ONCE. EVERY ITERATION: 1 MPI_Allgatherv AND 2 MPI_Allreduce*/
+    if(solver == SOLVER_CG){
+        if(rows_number != columns_number){
+            if(my_rank == 0) fprintf(stderr, "[ERR] --solver=cg needs a square matrix\n");
+            MPI_Abort(MPI_COMM_WORLD,1);
+        }
+        int n_local = local_array_size;
+        vector<int> cg_col_ind(csr_col_ind.size());
+        for(size_t k = 0; k < csr_col_ind.size(); k++)
+            cg_col_ind[k] = displs[csr_col_ind[k] % num_proc] + csr_col_ind[k] / num_proc;
+
+        //b = A*x_true (not timed)
+        vector<double> b(n_local), x(n_local, 0.0), Ap(n_local);
+        MPI_Allgatherv(local_array.data(), n_local, MPI_DOUBLE, global_array.data(), recv_counts.data(), displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+        cg_spmv_dot(n_local, csr_row_ptr.data(), cg_col_ind.data(), csr_values.data(), global_array.data(), local_array.data(), b.data());
+        vector<double> r(b), p(b);
+
+        double local_rr = cg_dot(n_local, r.data(), r.data()), rr;
+        MPI_Allreduce(&local_rr, &rr, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        double rr0 = rr, stop = cg_tolerance * cg_tolerance * rr0;
+        int iterations = 0;
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        start = MPI_Wtime();
+
+        while(iterations < cg_iterations && rr > stop){
+            MPI_Allgatherv(p.data(), n_local, MPI_DOUBLE, global_array.data(), recv_counts.data(), displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+            //1. Ap = A*p FUSED WITH p.Ap
+            double local_pAp = cg_spmv_dot(n_local, csr_row_ptr.data(), cg_col_ind.data(), csr_values.data(), global_array.data(), p.data(), Ap.data()), pAp;
+            MPI_Allreduce(&local_pAp, &pAp, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+            if(pAp == 0.0) break;//BREAKDOWN (SINGULAR MATRIX)
+            double alpha = rr / pAp;
+
+            //2. x += alpha*p, r -= alpha*Ap FUSED WITH r.r
+            double local_rr_new = cg_update(n_local, alpha, p.data(), Ap.data(), x.data(), r.data()), rr_new;
+            MPI_Allreduce(&local_rr_new, &rr_new, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+            //3. p = r + beta*p
+            cg_direction(n_local, rr_new / rr, r.data(), p.data());
+            rr = rr_new;
+            iterations++;
+        }
+
+        end = MPI_Wtime();
+        double local_time = end - start, cg_time;
+        MPI_Reduce(&local_time, &cg_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+        //||x - x_true|| and ||x_true||
+        double local_norms[2] = {0.0, 0.0}, norms[2];
+        for(int i = 0; i < n_local; i++){
+            local_norms[0] += (x[i] - local_array[i]) * (x[i] - local_array[i]);
+            local_norms[1] += local_array[i] * local_array[i];
+        }
+        MPI_Reduce(local_norms, norms, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+        if(my_rank == 0){
+            printf("CG | %s\nIterations: %d | RelResidual: %e | RelError: %e\n", filename, iterations,
+                   rr0 > 0.0 ? sqrt(rr / rr0) : 0.0, norms[1] > 0.0 ? sqrt(norms[0] / norms[1]) : sqrt(norms[0]));
+            printf("Time: %.9f | TimePerIteration: %.9f\n\n\n", cg_time, iterations ? cg_time / iterations : 0.0);
+        }
+
+        MPI_Finalize();
+        return 0;
+    }
+
+    /*REDUCED PRECISION: THE DOUBLE RESULT IS COMPUTED ONCE (REFERENCE FOR THE ERROR), THEN THE VALUES (AND x) ARE CONVERTED TO float*/
+    vector<float> csr_values_f;
+    vector<float> local_array_f;
+    vector<float> global_array_f;
+    vector<double> reference_result;
+    if(precision != PRECISION_DOUBLE){
+        MPI_Allgatherv(local_array.data(), local_x_values, MPI_DOUBLE, global_array.data(), recv_counts.data(), displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+        reference_result.resize(max_local_rows);
+        local_spmv(max_local_rows, csr_row_ptr, csr_col_ind, csr_values, global_array, reference_result);
+
+        csr_values_f.assign(csr_values.begin(), csr_values.end());
+        vector<double>().swap(csr_values);//ONLY THE float VALUES ARE KEPT
+
+        if(precision == PRECISION_FLOAT_X){
+            local_array_f.assign(local_array.begin(), local_array.end());
+            global_array_f.resize(columns_number);
+            vector<double>().swap(global_array);
+        }
+    }
 
     vector<double> my_times;
-    my_times.reserve(NUM_ITERATIONS);
+    my_times.reserve(iterations);
 
-    for(int iter = 0; iter < NUM_ITERATIONS; iter++) {
+    //THE FIRST warmup PRODUCTS ARE NOT TIMED
+    for(int iter = 0; iter < warmup + iterations; iter++) {
         
         MPI_Barrier(MPI_COMM_WORLD);
 
         start = MPI_Wtime();
 
-        MPI_Allgatherv(local_array.data(), local_array_size, MPI_DOUBLE, global_array.data(), recv_counts.data(), displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
-
-        for(int i = 0; i < max_local_rows; i++) {
-            double dot_product = 0.0;
-            int start_idx = csr_row_ptr[i];
-            int end_idx   = csr_row_ptr[i+1];
+        if(precision == PRECISION_FLOAT_X)//x IN float: HALF OF THE PAYLOAD
+            MPI_Allgatherv(local_array_f.data(), local_x_values, MPI_FLOAT, global_array_f.data(), recv_counts.data(), displs.data(), MPI_FLOAT, MPI_COMM_WORLD);
+        else
+            MPI_Allgatherv(local_array.data(), local_x_values, MPI_DOUBLE, global_array.data(), recv_counts.data(), displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
 
-            for(int k = start_idx; k < end_idx; k++) {
-                dot_product += csr_values[k] * global_array[csr_col_ind[k]];
-            }
-            local_result[i] = dot_product; 
-        }
+        if(vectors > 1)//THE LOCAL CSR IS READ ONCE FOR THE k VECTORS
+            spmm(vectors, max_local_rows, csr_row_ptr.data(), csr_col_ind.data(), csr_values.data(), global_array.data(), local_result.data());
+        else if(precision == PRECISION_DOUBLE)
+            local_spmv(max_local_rows, csr_row_ptr, csr_col_ind, csr_values, global_array, local_result);
+        else if(precision == PRECISION_FLOAT)
+            local_spmv(max_local_rows, csr_row_ptr, csr_col_ind, csr_values_f, global_array, local_result);
+        else
+            local_spmv(max_local_rows, csr_row_ptr, csr_col_ind, csr_values_f, global_array_f, local_result);
 
         end = MPI_Wtime();
-        my_times.push_back(end - start);
+        if(iter >= warmup)
+            my_times.push_back(end - start);
     }
 
     double total_time=0.0;
     for(double t : my_times)
         total_time+=t;
-    double avg_time = total_time / NUM_ITERATIONS;
+    double avg_time = total_time / iterations;
+
+    double local_gflops = (2.0 * local_nnz_count * vectors) / (avg_time * 1e9);
+
+    /*MAX RELATIVE ERROR OF THE REDUCED PRECISION AGAINST THE DOUBLE RESULT (ABSOLUTE WHERE THE RESULT IS 0)*/
+    double local_error = 0.0, max_error = 0.0;
+    if(precision != PRECISION_DOUBLE){
+        for(int i = 0; i < max_local_rows; i++){
+            double diff = fabs(local_result[i] - reference_result[i]);
+            double error = reference_result[i] != 0.0 ? diff / fabs(reference_result[i]) : diff;
+            if(error > local_error) local_error = error;
+        }
+        MPI_Reduce(&local_error, &max_error, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
 
-    double local_gflops = (2.0 * csr_values.size()) / (avg_time * 1e9);
+    /*--roofline: STREAM TRIAD ON ALL THE RANKS AT THE SAME TIME (ARRAYS DIVIDED BY THE RANKS OF THE NODE, SO THE NODE MEMORY IS NOT
+      EXCEEDED), THEN THE BYTES OF THE LOCAL PRODUCT: LOCAL CSR, LINES OF THE GATHERED x REACHED BY THE LOCAL COLUMNS, LOCAL y.
+      THE SUMS OVER THE RANKS GO TO RANK 0 (BANDWIDTH, MATRIX, x, y). THE MPI_Allgatherv IS NOT MEMORY TRAFFIC OF THE MODEL*/
+    double roofline_local[4] = {0.0, 0.0, 0.0, 0.0}, roofline_sum[4] = {0.0, 0.0, 0.0, 0.0};
+    if(roofline){
+        MPI_Comm node_comm;
+        int node_ranks;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_size(node_comm, &node_ranks);
+        MPI_Comm_free(&node_comm);
+
+        struct Sync { static void barrier() { MPI_Barrier(MPI_COMM_WORLD); } };
+        roofline_local[0] = stream_triad(stream_elements(node_ranks), Sync::barrier);
+        roofline_local[1] = (max_local_rows + 1.0) * sizeof(int) + local_nnz_count * (sizeof(int) + (precision == PRECISION_DOUBLE ? sizeof(double) : sizeof(float)));
+        roofline_local[2] = x_lines_bytes(csr_col_ind.data(), local_nnz_count, columns_number,
+                                          precision == PRECISION_FLOAT_X ? sizeof(float) : sizeof(double) * vectors);
+        roofline_local[3] = (double)max_local_rows * sizeof(double) * vectors;
+        MPI_Reduce(roofline_local, roofline_sum, 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
 
     vector<double> all_times_buffer;
     vector<double> all_nnz_values;
     vector<double> all_gflops;
 
     if (my_rank == 0) {
-        all_times_buffer.resize(num_proc * NUM_ITERATIONS);
+        all_times_buffer.resize(num_proc * iterations);
         all_nnz_values.resize(num_proc);
         all_gflops.resize(num_proc);
     }
 
-    double local_nnz = csr_values.size();
+    double local_nnz = local_nnz_count;
 
-    MPI_Gather(my_times.data(), NUM_ITERATIONS, MPI_DOUBLE, all_times_buffer.data(), NUM_ITERATIONS, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather(my_times.data(), iterations, MPI_DOUBLE, all_times_buffer.data(), iterations, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     MPI_Gather(&local_nnz, 1, MPI_DOUBLE, all_nnz_values.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     MPI_Gather(&local_gflops, 1, MPI_DOUBLE, all_gflops.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD); // Corretto
 
     if (my_rank == 0) {
         for (int p = 0; p < num_proc; p++) {
-            printf("Rank %d | %s\nLocalNNZ: %f | LocalPerf: %f GFLOPS\n", p, argv[1], all_nnz_values[p], all_gflops[p]);
+            printf("Rank %d | %s\nLocalNNZ: %f | LocalPerf: %f GFLOPS\n", p, filename, all_nnz_values[p], all_gflops[p]);
             
-            for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
-                int index = p * NUM_ITERATIONS + iter;
+            for (int iter = 0; iter < iterations; iter++) {
+                int index = p * iterations + iter;
                 printf("%.9f ", all_times_buffer[index]);
             }
             printf("\n");
         }
+        //A PRODUCT LASTS AS LONG AS ITS SLOWEST RANK: THE SAMPLES OF THE RECORD AND OF THE ROOFLINE ARE THE MAX OVER THE RANKS OF EVERY ITERATION
+        vector<double> samples(iterations, 0.0);
+        long long total_nnz = 0;
+        for (int p = 0; p < num_proc; p++) {
+            total_nnz += (long long)all_nnz_values[p];
+            for (int iter = 0; iter < iterations; iter++)
+                samples[iter] = max(samples[iter], all_times_buffer[p * iterations + iter]);
+        }
+        char label[32];
+        if(vectors > 1) snprintf(label, sizeof(label), "spmm-k%d", vectors);
+        else if(precision != PRECISION_DOUBLE) snprintf(label, sizeof(label), "csr-%s", precision_names[precision]);
+        else snprintf(label, sizeof(label), "csr");
+
+        if(precision != PRECISION_DOUBLE)
+            printf("Precision: %s | MaxRelError: %e\n", precision_names[precision], max_error);
+        if(roofline){
+            RooflineTraffic traffic;
+            traffic.matrix = roofline_sum[1];
+            traffic.x = roofline_sum[2];
+            traffic.y = roofline_sum[3];
+            char who[32];
+            snprintf(who, sizeof(who), "%d ranks", num_proc);
+            roofline_report(stdout, filename, label, 2.0 * total_nnz * vectors, traffic, bench_stats(samples).median, roofline_sum[0], who);
+        }
         printf("\n\n");
+
+        //BENCHMARK RECORD
+        if(bench_output){
+            BenchRecord record;
+            record.stats.n = 0;
+            record.matrix = bench_basename(filename);
+            record.kernel = label;
+            record.schedule = "-";
+            record.threads = 1;
+            record.ranks = num_proc;
+            record.rows = rows_number;
+            record.columns = columns_number;
+            record.nnz = total_nnz;
+            record.vectors = vectors;
+            record.warmup = warmup;
+            record.bytes = csr_traffic_bytes(rows_number, columns_number, total_nnz, precision == PRECISION_DOUBLE ? 8 : 4, vectors);
+            record.stats = bench_stats(samples);
+            bench_write(bench_output, record);
+        }
     }
 
     MPI_Finalize();
@@ -0,0 +1,244 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+/*
+ * AUTO-TUNER OF THE SpMV ENGINE (Deliverable_1/source/spmv_engine.cpp)
+ *
+ * Instead of choosing by hand one of the schedule*.cpp binaries, the engine times short trial runs on the loaded
+ * matrix and keeps the fastest configuration. The search is a coordinate descent (a full cross product of
+ * kernels x schedules x threads would take longer than the measurement itself):
+ *   1. threads: from the maximum, halving, while the time keeps improving (static schedule);
+ *   2. schedule kind and chunk with the best thread count (passed with omp_set_schedule to schedule(runtime));
+ *   3. kernel variant (csr, sell, bcsr, merge, delta, balanced, tiled, prefetch, bucketed) with the best threads and schedule;
+ *   4. schedule again if the winning kernel is not csr (merge, balanced and tiled split the work by themselves,
+ *      no schedule to tune).
+ * Every dimension given on the command line (--kernel, --schedule, --threads) is fixed and not searched.
+ * A trial is one warm-up run and then runs until TUNE_MIN_TIME seconds (at least TUNE_MIN_REPS, at most
+ * TUNE_MAX_REPS); the best run is kept, since short trials are disturbed mostly upwards.
+ *
+ * The result of a full search is appended to a text tuning cache, one line per matrix:
+ *   <fingerprint> <kernel> <schedule kind> <chunk> <threads> <seconds>
+ * the fingerprint is made of the structure of the matrix (size, nnz, checksum of rows_ptr and cols), of the host
+ * name and of the maximum number of threads, so a cached choice is reused only on the same matrix and machine.
+ * The cache is spmv_tune.cache in the directory of the matrix, SPMV_TUNE_CACHE=<path> changes it and
+ * SPMV_TUNE_CACHE=0 disables it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_cache.h"
+#include "spmv_kernels.h"
+
+#define TUNE_MIN_TIME 0.05
+#define TUNE_MIN_REPS 3
+#define TUNE_MAX_REPS 50
+#define TUNE_FAILED 1e300   //time of a choice whose kernel could not be prepared
+
+struct TuneChoice {
+    int kernel;
+    int schedule_kind;
+    int schedule_chunk;
+    int threads;
+    double seconds;     //best trial time of one product (0 if not measured)
+};
+
+//schedules tried by the tuner: the clauses of the schedule*.cpp binaries plus larger dynamic chunks
+static const int tune_schedules[][2] = {
+    {SCHEDULE_STATIC, 0}, {SCHEDULE_DYNAMIC, 1}, {SCHEDULE_DYNAMIC, 100}, {SCHEDULE_DYNAMIC, 1000},
+    {SCHEDULE_GUIDED, 0}, {SCHEDULE_GUIDED, 100}
+};
+#define TUNE_N_SCHEDULES 6
+
+//kernels tried by the tuner (sym needs the half storage, so it is only used when requested with --kernel=sym)
+static const int tune_kernels[] = {KERNEL_CSR, KERNEL_SELL, KERNEL_BCSR, KERNEL_MERGE, KERNEL_DELTA, KERNEL_BALANCED, KERNEL_TILED,
+                                   KERNEL_PREFETCH, KERNEL_BUCKETED};
+#define TUNE_N_KERNELS 9
+
+static inline void apply_choice(const TuneChoice& c) {
+#ifdef _OPENMP
+    omp_set_num_threads(c.threads);
+    omp_set_schedule((omp_sched_t)c.schedule_kind, c.schedule_chunk);
+#else
+    (void)c;
+#endif
+}
+
+static inline double tune_wtime() {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+#endif
+}
+
+//best time of one product with the prepared kernel (threads and schedule already applied)
+static inline double time_trial(SpmvKernel& kernel, const double* x, double* y) {
+    run_kernel(kernel, x, y);   //warm-up
+    double best = 1e300, total = 0.0;
+    for (int rep = 0; rep < TUNE_MAX_REPS && (rep < TUNE_MIN_REPS || total < TUNE_MIN_TIME); rep++) {
+        double start = tune_wtime();
+        run_kernel(kernel, x, y);
+        double t = tune_wtime() - start;
+        total += t;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+//prepares the kernel of the choice (with its thread count: some kernels split the work at preparation) and times it
+static inline double time_choice(const SpmvOptions& opts, const CSRMatrix& csr, TuneChoice& c, const double* x, double* y) {
+    apply_choice(c);
+    SpmvOptions trial = opts;
+    trial.kernel = c.kernel;
+    SpmvKernel kernel;
+    //a kernel that cannot be built never wins (and a failed first choice is not stored in the cache)
+    c.seconds = TUNE_FAILED;
+    if (prepare_kernel(trial, csr, kernel) != 0) return c.seconds;
+    c.seconds = time_trial(kernel, x, y);
+    return c.seconds;
+}
+
+//tries the schedules with the kernel and threads of best (the prepared kernel is reused)
+static inline void tune_schedule(const SpmvOptions& opts, const CSRMatrix& csr, TuneChoice& best, const double* x, double* y) {
+    apply_choice(best);
+    SpmvOptions trial = opts;
+    trial.kernel = best.kernel;
+    SpmvKernel kernel;
+    if (prepare_kernel(trial, csr, kernel) != 0) return;
+
+    for (int s = 0; s < TUNE_N_SCHEDULES; s++) {
+        TuneChoice c = best;
+        c.schedule_kind = tune_schedules[s][0];
+        c.schedule_chunk = tune_schedules[s][1];
+        apply_choice(c);
+        c.seconds = time_trial(kernel, x, y);
+        if (c.seconds < best.seconds) best = c;
+    }
+}
+
+/*SEARCH OF THE FASTEST CONFIGURATION (THE FIXED DIMENSIONS ARE TAKEN FROM opts)*/
+static inline TuneChoice autotune(const SpmvOptions& opts, const CSRMatrix& csr, const double* x, double* y) {
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    //only the csr kernel supports reduced precision, multiple vectors, the CG solver and the transpose product
+    int kernel_fixed = opts.kernel >= 0 || opts.precision != PRECISION_DOUBLE || opts.vectors > 1 || opts.solver != SOLVER_SPMV ||
+                       opts.transpose != TRANSPOSE_OFF;
+
+    TuneChoice best;
+    best.kernel = opts.kernel >= 0 ? opts.kernel : KERNEL_CSR;
+    best.schedule_kind = opts.schedule_kind >= 0 ? opts.schedule_kind : SCHEDULE_STATIC;
+    best.schedule_chunk = opts.schedule_kind >= 0 ? opts.schedule_chunk : 0;
+    best.threads = opts.threads > 0 ? opts.threads : max_threads;
+    time_choice(opts, csr, best, x, y);
+
+    /*1. THREADS*/
+    if (opts.threads == 0) {
+        for (int t = max_threads / 2; t >= 1; t /= 2) {
+            TuneChoice c = best;
+            c.threads = t;
+            if (time_choice(opts, csr, c, x, y) >= best.seconds) break;
+            best = c;
+        }
+    }
+
+    /*2. SCHEDULE*/
+    if (opts.schedule_kind < 0) tune_schedule(opts, csr, best, x, y);
+
+    /*3. KERNEL*/
+    if (!kernel_fixed) {
+        int first = best.kernel;
+        for (int k = 0; k < TUNE_N_KERNELS; k++) {
+            if (tune_kernels[k] == first) continue;
+            //with --prefetch-distance=sweep there is no distance to time the prefetch kernel with
+            if (tune_kernels[k] == KERNEL_PREFETCH && opts.prefetch_distance < 0) continue;
+            TuneChoice c = best;
+            c.kernel = tune_kernels[k];
+            if (time_choice(opts, csr, c, x, y) < best.seconds) best = c;
+        }
+        /*4. SCHEDULE OF THE WINNING KERNEL*/
+        if (best.kernel != first && best.kernel != KERNEL_MERGE && best.kernel != KERNEL_BALANCED &&
+            best.kernel != KERNEL_TILED && opts.schedule_kind < 0)
+            tune_schedule(opts, csr, best, x, y);
+    }
+    return best;
+}
+
+/*TUNING CACHE*/
+static inline std::string tune_cache_path(const char* matrix_path) {
+    const char* env = getenv("SPMV_TUNE_CACHE");
+    if (env && strcmp(env, "0") == 0) return std::string();
+    if (env && env[0]) return std::string(env);
+
+    std::string path(matrix_path);
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos ? std::string() : path.substr(0, slash + 1)) + "spmv_tune.cache";
+}
+
+//host, threads and structure of the matrix (the values do not change the best configuration)
+static inline std::string tune_fingerprint(const CSRMatrix& csr, const SpmvOptions& opts) {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    for (char* p = host; *p; p++) if (*p == ' ') *p = '_';
+
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    uint64_t structure = csr_cache_checksum(csr.rows_ptr, (size_t)(csr.rows_number + 1) * sizeof(int), 1)
+                       + csr_cache_checksum(csr.cols, (size_t)csr.nnz * sizeof(int), 2);
+
+    //the settings of the formats change the time of their trials, so a winner is reused only with the same ones
+    char key[512];
+    snprintf(key, sizeof(key), "%dx%d-nnz%d-%016llx-%s-t%d-%s-k%d-sell%d,%d-bcsr%dx%d-pd%d-cache%lld", csr.rows_number,
+             csr.columns_number, csr.nnz, (unsigned long long)structure, host, max_threads, precision_names[opts.precision],
+             opts.vectors, opts.sell_c, opts.sell_sigma, opts.bcsr_r, opts.bcsr_c, opts.prefetch_distance, opts.cache_size);
+    //the transpose product is a different operation: its choice is kept apart (the key of A*x is unchanged)
+    if (opts.transpose != TRANSPOSE_OFF)
+        return std::string(key) + "-T" + transpose_names[opts.transpose];
+    return std::string(key);
+}
+
+//last entry of the cache with this fingerprint, 0 if found
+static inline int tune_cache_lookup(const std::string& path, const std::string& key, TuneChoice& c) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return 1;
+
+    char line[1024], name[64];
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char stored_key[512];
+        TuneChoice t;
+        if (sscanf(line, "%511s %63s %d %d %d %lf", stored_key, name, &t.schedule_kind, &t.schedule_chunk, &t.threads, &t.seconds) != 6)
+            continue;
+        if (key != stored_key) continue;
+        t.kernel = -1;
+        for (int k = 0; k < KERNEL_COUNT; k++)
+            if (strcmp(name, kernel_names[k]) == 0) t.kernel = k;
+        if (t.kernel < 0 || t.schedule_kind < SCHEDULE_STATIC || t.schedule_kind > SCHEDULE_GUIDED || t.threads < 1) continue;
+        c = t;
+        found = 1;
+    }
+    fclose(f);
+    return !found;
+}
+
+static inline int tune_cache_store(const std::string& path, const std::string& key, const TuneChoice& c) {
+    FILE* f = fopen(path.c_str(), "a");
+    if (!f) return 1;
+    fprintf(f, "%s %s %d %d %d %.9f\n", key.c_str(), kernel_names[c.kernel], c.schedule_kind, c.schedule_chunk, c.threads, c.seconds);
+    return fclose(f) != 0;
+}
+
+#endif
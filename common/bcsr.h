@@ -0,0 +1,242 @@
+#ifndef BCSR_H
+#define BCSR_H
+
+/*
+ * BLOCK CSR (REGISTER BLOCKING) FOR MATRICES MADE OF SMALL DENSE BLOCKS (FEM MATRICES: 3x3, 6x6 NODE BLOCKS)
+ *
+ * The matrix is split into R x C blocks; every non-empty block is stored dense (row-major, explicit zeros
+ * included) with ONE column index, so the index traffic goes from one int per value to one int per block and
+ * every x[col..col+C) loaded is reused by the R rows of the block row. The kernel is instantiated for every
+ * supported R x C so that the block and the R partial sums stay in registers.
+ *
+ * The column stored for a block is its first column. When the number of columns is not a multiple of C the
+ * blocks of the last (partial) block column are shifted left to start at columns_number - C, so the kernel never
+ * reads past the end of x. The last block row, when partial, is computed by a bounded loop.
+ *
+ * The block size is chosen by bcsr_choose_block(): the fill ratio (stored values / real nonzeros) of every
+ * candidate is estimated on a sample of block rows and the block minimizing the estimated memory traffic per
+ * nonzero is taken (1x1 is plain CSR, so a matrix without block structure is not penalized).
+ */
+
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+
+//candidate block dimensions (for both R and C)
+static const int bcsr_dims[] = {1, 2, 3, 4, 6};
+#define BCSR_N_DIMS 5
+
+struct BcsrMatrix {
+    int R, C;
+    int rows_number;
+    int columns_number;
+    int block_rows;                 //ceil(rows_number / R)
+    std::vector<int> brow_ptr;      //blocks of every block row (block_rows + 1)
+    std::vector<int> bcols;         //first column of every block
+    std::vector<double> values;     //R*C values for every block, row-major
+    double fill_ratio;              //stored values / nonzeros
+};
+
+//first column of the block containing column col (shifted for the last partial block column)
+static inline int bcsr_block_start(int col, int C, int columns_number) {
+    int start = col - col % C;
+    if (start + C > columns_number) start = std::max(0, columns_number - C);
+    return start;
+}
+
+/*
+ * ESTIMATED FILL RATIO OF AN R x C BLOCKING, computed on one block row every `stride`.
+ * mark[] (one slot per block column) holds the last block row that touched the block column, so it never needs clearing.
+ */
+static inline double bcsr_estimate_fill(const CSRMatrix& csr, int R, int C, int stride) {
+    int rows_number = csr.rows_number;
+    int block_rows = (rows_number + R - 1) / R;
+    int block_cols = (csr.columns_number + C - 1) / C;
+    long long blocks = 0, nnz = 0;
+
+    #pragma omp parallel reduction(+:blocks, nnz)
+    {
+        std::vector<int> mark(block_cols, -1);
+        #pragma omp for schedule(dynamic, 64)
+        for (int br = 0; br < block_rows; br += stride) {
+            int hi = std::min(rows_number, (br + 1) * R);
+            for (int r = br * R; r < hi; r++) {
+                for (int idx = csr.rows_ptr[r]; idx < csr.rows_ptr[r + 1]; idx++) {
+                    int start = bcsr_block_start(csr.cols[idx], C, csr.columns_number);
+                    int bc = (start % C) ? block_cols - 1 : start / C;  //a shifted block is the last block column
+                    if (mark[bc] != br) {
+                        mark[bc] = br;
+                        blocks++;
+                    }
+                }
+                nnz += csr.rows_ptr[r + 1] - csr.rows_ptr[r];
+            }
+        }
+    }
+    return nnz > 0 ? (double)blocks * R * C / nnz : 1.0;
+}
+
+/*
+ * CHOICE OF THE BLOCK SIZE. Traffic model per nonzero: fill * (8 bytes of value + 4 bytes of column index / (R*C)),
+ * i.e. 12 bytes for CSR. About 2% of the block rows are sampled (all of them for small matrices).
+ */
+static inline void bcsr_choose_block(const CSRMatrix& csr, int& best_r, int& best_c) {
+    best_r = 1;
+    best_c = 1;
+    double best_cost = 12.0;
+
+    for (int a = 0; a < BCSR_N_DIMS; a++) {
+        int R = bcsr_dims[a];
+        if (R > csr.rows_number) continue;
+        int block_rows = (csr.rows_number + R - 1) / R;
+        int stride = block_rows > 50000 ? 50 : 1;
+
+        for (int b = 0; b < BCSR_N_DIMS; b++) {
+            int C = bcsr_dims[b];
+            if (C > csr.columns_number || (R == 1 && C == 1)) continue;
+            double fill = bcsr_estimate_fill(csr, R, C, stride);
+            double cost = fill * (8.0 + 4.0 / (R * C));
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_r = R;
+                best_c = C;
+            }
+        }
+    }
+}
+
+/*CREATION OF THE BCSR REPRESENTATION FROM THE CSR ONE*/
+static inline void build_bcsr(const CSRMatrix& csr, int R, int C, BcsrMatrix& b) {
+    int rows_number = csr.rows_number;
+    int columns_number = csr.columns_number;
+    //blocks wider than the matrix: largest width of bcsr_dims that fits (the kernels exist only for those)
+    for (int b = BCSR_N_DIMS - 1; C > columns_number && b >= 0; b--)
+        if (bcsr_dims[b] <= columns_number || b == 0) C = bcsr_dims[b];
+
+    b.R = R;
+    b.C = C;
+    b.rows_number = rows_number;
+    b.columns_number = columns_number;
+    b.block_rows = (rows_number + R - 1) / R;
+    b.brow_ptr.assign(b.block_rows + 1, 0);
+
+    /*NUMBER OF DISTINCT BLOCKS IN EVERY BLOCK ROW (the block starts are collected and sorted per block row)*/
+    #pragma omp parallel
+    {
+        std::vector<int> starts;
+        #pragma omp for schedule(dynamic, 256)
+        for (int br = 0; br < b.block_rows; br++) {
+            starts.clear();
+            int hi = std::min(rows_number, (br + 1) * R);
+            for (int r = br * R; r < hi; r++)
+                for (int idx = csr.rows_ptr[r]; idx < csr.rows_ptr[r + 1]; idx++)
+                    starts.push_back(bcsr_block_start(csr.cols[idx], C, columns_number));
+            std::sort(starts.begin(), starts.end());
+            b.brow_ptr[br] = (int)(std::unique(starts.begin(), starts.end()) - starts.begin());
+        }
+    }
+    parallel_exclusive_scan(b.brow_ptr.data(), b.block_rows);
+
+    int n_blocks = b.brow_ptr[b.block_rows];
+    b.bcols.resize(n_blocks);
+    b.values.assign((size_t)n_blocks * R * C, 0.0);
+
+    /*FILL: the blocks of a block row are in increasing column order, each entry is found with a binary search*/
+    #pragma omp parallel
+    {
+        std::vector<int> starts;
+        #pragma omp for schedule(dynamic, 256)
+        for (int br = 0; br < b.block_rows; br++) {
+            starts.clear();
+            int hi = std::min(rows_number, (br + 1) * R);
+            for (int r = br * R; r < hi; r++)
+                for (int idx = csr.rows_ptr[r]; idx < csr.rows_ptr[r + 1]; idx++)
+                    starts.push_back(bcsr_block_start(csr.cols[idx], C, columns_number));
+            std::sort(starts.begin(), starts.end());
+            starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+            int first = b.brow_ptr[br];
+            for (size_t k = 0; k < starts.size(); k++) b.bcols[first + k] = starts[k];
+
+            for (int r = br * R; r < hi; r++) {
+                for (int idx = csr.rows_ptr[r]; idx < csr.rows_ptr[r + 1]; idx++) {
+                    int start = bcsr_block_start(csr.cols[idx], C, columns_number);
+                    int k = first + (int)(std::lower_bound(starts.begin(), starts.end(), start) - starts.begin());
+                    b.values[(size_t)k * R * C + (r - br * R) * C + (csr.cols[idx] - start)] += csr.values[idx];
+                }
+            }
+        }
+    }
+
+    b.fill_ratio = csr.nnz > 0 ? (double)n_blocks * R * C / csr.nnz : 1.0;
+}
+
+/*y = A*x FOR THE FULL BLOCK ROWS, R AND C ARE COMPILE-TIME CONSTANTS SO THE BLOCK LOOPS ARE FULLY UNROLLED*/
+template <int R, int C>
+static inline void spmv_bcsr_rc(const BcsrMatrix& b, const double* x, double* y) {
+    const int* brow_ptr = b.brow_ptr.data();
+    const int* bcols = b.bcols.data();
+    const double* values = b.values.data();
+    int full_block_rows = b.rows_number / R;
+
+    #pragma omp parallel for schedule(runtime)
+    for (int br = 0; br < full_block_rows; br++) {
+        double acc[R];
+        for (int i = 0; i < R; i++) acc[i] = 0.0;
+
+        for (int k = brow_ptr[br]; k < brow_ptr[br + 1]; k++) {
+            const double* block = values + (size_t)k * R * C;
+            const double* xb = x + bcols[k];
+            double xv[C];
+            for (int j = 0; j < C; j++) xv[j] = xb[j];
+            for (int i = 0; i < R; i++)
+                for (int j = 0; j < C; j++)
+                    acc[i] += block[i * C + j] * xv[j];
+        }
+        for (int i = 0; i < R; i++) y[br * R + i] = acc[i];
+    }
+}
+
+//block row br with R and C known only at run time
+static inline void spmv_bcsr_block_row(const BcsrMatrix& b, int br, const double* x, double* y) {
+    int R = b.R, C = b.C;
+    for (int i = 0; i < R && br * R + i < b.rows_number; i++) {
+        double sum = 0.0;
+        for (int k = b.brow_ptr[br]; k < b.brow_ptr[br + 1]; k++)
+            for (int j = 0; j < C; j++)
+                sum += b.values[(size_t)k * R * C + i * C + j] * x[b.bcols[k] + j];
+        y[br * R + i] = sum;
+    }
+}
+
+//last block row when rows_number is not a multiple of R
+static inline void spmv_bcsr_tail(const BcsrMatrix& b, const double* x, double* y) {
+    int br = b.rows_number / b.R;
+    if (br < b.block_rows) spmv_bcsr_block_row(b, br, x, y);
+}
+
+#define BCSR_CASE(r, c) case (r) * 8 + (c): spmv_bcsr_rc<r, c>(b, x, y); break;
+#define BCSR_ROW(r) BCSR_CASE(r, 1) BCSR_CASE(r, 2) BCSR_CASE(r, 3) BCSR_CASE(r, 4) BCSR_CASE(r, 6)
+
+/*y = A*x WITH THE BCSR MATRIX (R, C IN bcsr_dims)*/
+static inline void spmv_bcsr(const BcsrMatrix& b, const double* x, double* y) {
+    switch (b.R * 8 + b.C) {
+        BCSR_ROW(1) BCSR_ROW(2) BCSR_ROW(3) BCSR_ROW(4) BCSR_ROW(6)
+        default: {
+            //R or C outside bcsr_dims (never built by build_bcsr): generic loop, slower but never a wrong y
+            int full_block_rows = b.rows_number / b.R;
+            #pragma omp parallel for schedule(runtime)
+            for (int br = 0; br < full_block_rows; br++) spmv_bcsr_block_row(b, br, x, y);
+            break;
+        }
+    }
+    spmv_bcsr_tail(b, x, y);
+}
+
+#undef BCSR_ROW
+#undef BCSR_CASE
+
+#endif
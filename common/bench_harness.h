@@ -0,0 +1,185 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+/*
+ * BENCHMARK RECORDS (--bench-output=FILE, OpenMP AND MPI BINARIES)
+ *
+ * The timed products of a run (after the warm-up ones) are the samples; from them:
+ *   - min, max, mean, standard deviation, median, 10th and 90th percentile (linear interpolation between the
+ *     sorted samples, as PERCENTILE.INC of the spreadsheets in plots/);
+ *   - the 95% confidence interval of the median, from the order statistics (ranks n/2 -+ 1.96*sqrt(n)/2 of
+ *     the sorted samples): it does not assume normal times, which are skewed upwards by interference;
+ *   - GFLOP/s = 2 * nnz * vectors / median time;
+ *   - effective bandwidth = bytes / median time, with the bytes of the CSR product read or written at least
+ *     once: rows_ptr, cols, values, x and y (the gathers of x that miss the cache are not counted, so the
+ *     value is a lower bound of the real traffic; every kernel is measured with the same model).
+ * One record per run is appended to FILE with the matrix, the kernel, the schedule, the threads and the
+ * ranks, the host and the CPU model: FILE ending in .json gets one JSON object per line (JSON Lines),
+ * any other name gets CSV lines with quoted text fields (the header is written when the file is new or empty).
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+struct BenchStats {
+    int n;
+    double min, max, mean, stddev;
+    double median, p10, p90;
+    double ci_low, ci_high;     //95% confidence interval of the median
+};
+
+struct BenchRecord {
+    std::string matrix;         //file name without the directories
+    std::string kernel;         //label of the kernel (e.g. "csr", "bcsr3x3", "spmm-k4")
+    std::string schedule;       //kind,chunk ("-" if not OpenMP)
+    int threads;
+    int ranks;
+    long long rows, columns, nnz;
+    int vectors;
+    int warmup;
+    double bytes;               //bytes of one product (see csr_traffic_bytes)
+    BenchStats stats;
+};
+
+//p-th percentile (0..1) of sorted samples, linear interpolation
+static inline double bench_percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    double pos = p * (sorted.size() - 1);
+    size_t lo = (size_t)pos;
+    if (lo + 1 >= sorted.size()) return sorted.back();
+    return sorted[lo] + (pos - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+static inline BenchStats bench_stats(const std::vector<double>& samples) {
+    BenchStats s;
+    memset(&s, 0, sizeof(s));
+    s.n = (int)samples.size();
+    if (s.n == 0) return s;
+
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    s.min = sorted.front();
+    s.max = sorted.back();
+    for (int i = 0; i < s.n; i++) s.mean += sorted[i];
+    s.mean /= s.n;
+    for (int i = 0; i < s.n; i++) s.stddev += (sorted[i] - s.mean) * (sorted[i] - s.mean);
+    s.stddev = s.n > 1 ? sqrt(s.stddev / (s.n - 1)) : 0.0;
+    s.median = bench_percentile(sorted, 0.5);
+    s.p10 = bench_percentile(sorted, 0.1);
+    s.p90 = bench_percentile(sorted, 0.9);
+
+    //ranks (1-based) of the order statistics bounding the median with 95% confidence
+    double half_width = 1.96 * sqrt((double)s.n) / 2.0;
+    int lo = (int)floor(s.n / 2.0 - half_width), hi = (int)ceil(1.0 + s.n / 2.0 + half_width);
+    lo = std::max(lo, 1);
+    hi = std::min(hi, s.n);
+    s.ci_low = sorted[lo - 1];
+    s.ci_high = sorted[hi - 1];
+    return s;
+}
+
+//bytes read or written at least once by the CSR product (value_bytes: 8 double, 4 float)
+static inline double csr_traffic_bytes(long long rows, long long columns, long long nnz, int value_bytes, int vectors) {
+    return (double)(rows + 1) * sizeof(int) + (double)nnz * (sizeof(int) + value_bytes) +
+           (double)(columns + rows) * sizeof(double) * vectors;
+}
+
+static inline double bench_gflops(const BenchRecord& r) {
+    return r.stats.median > 0.0 ? 2.0 * r.nnz * r.vectors / r.stats.median / 1e9 : 0.0;
+}
+
+static inline double bench_bandwidth(const BenchRecord& r) {
+    return r.stats.median > 0.0 ? r.bytes / r.stats.median / 1e9 : 0.0;
+}
+
+static inline std::string bench_basename(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return std::string(slash ? slash + 1 : path);
+}
+
+static inline std::string bench_host() {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    return std::string(host);
+}
+
+//"model name" of /proc/cpuinfo
+static inline std::string bench_cpu_model() {
+    std::string model = "unknown";
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (!f) return model;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "model name", 10) != 0) continue;
+        const char* colon = strchr(line, ':');
+        if (!colon) continue;
+        colon++;
+        while (*colon == ' ') colon++;
+        model = colon;
+        while (!model.empty() && (model[model.size() - 1] == '\n' || model[model.size() - 1] == '\r')) model.erase(model.size() - 1);
+        break;
+    }
+    fclose(f);
+    return model;
+}
+
+//text without the characters that would break a quoted CSV field or a JSON string
+static inline std::string bench_clean(const std::string& text) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        out += (c == '"' || c == '\\' || (unsigned char)c < 32) ? '_' : c;
+    }
+    return out;
+}
+
+/*APPENDS THE RECORD TO path (JSON LINES IF IT ENDS IN .json, CSV OTHERWISE), 0 IF WRITTEN*/
+static inline int bench_write(const char* path, const BenchRecord& r) {
+    size_t len = strlen(path);
+    int json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+    struct stat st;
+    int new_file = stat(path, &st) != 0 || st.st_size == 0;
+
+    FILE* f = fopen(path, "a");
+    if (!f) {
+        fprintf(stderr, "[ERR] Could not open the benchmark output %s\n", path);
+        return 1;
+    }
+
+    char timestamp[32];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    std::string host = bench_clean(bench_host()), cpu = bench_clean(bench_cpu_model());
+    std::string matrix = bench_clean(r.matrix), kernel = bench_clean(r.kernel), schedule = bench_clean(r.schedule);
+    const BenchStats& s = r.stats;
+
+    if (json)
+        fprintf(f, "{\"timestamp\":\"%s\",\"host\":\"%s\",\"cpu\":\"%s\",\"matrix\":\"%s\",\"rows\":%lld,\"columns\":%lld,"
+                   "\"nnz\":%lld,\"kernel\":\"%s\",\"schedule\":\"%s\",\"threads\":%d,\"ranks\":%d,\"vectors\":%d,"
+                   "\"warmup\":%d,\"repetitions\":%d,\"min\":%.9f,\"median\":%.9f,\"mean\":%.9f,\"max\":%.9f,"
+                   "\"stddev\":%.9f,\"p10\":%.9f,\"p90\":%.9f,\"ci95_low\":%.9f,\"ci95_high\":%.9f,"
+                   "\"gflops\":%.6f,\"bandwidth_gbs\":%.6f}\n",
+                timestamp, host.c_str(), cpu.c_str(), matrix.c_str(), r.rows, r.columns, r.nnz, kernel.c_str(),
+                schedule.c_str(), r.threads, r.ranks, r.vectors, r.warmup, s.n, s.min, s.median, s.mean, s.max,
+                s.stddev, s.p10, s.p90, s.ci_low, s.ci_high, bench_gflops(r), bench_bandwidth(r));
+    else {
+        if (new_file)
+            fprintf(f, "timestamp,host,cpu,matrix,rows,columns,nnz,kernel,schedule,threads,ranks,vectors,warmup,repetitions,"
+                       "min,median,mean,max,stddev,p10,p90,ci95_low,ci95_high,gflops,bandwidth_gbs\n");
+        fprintf(f, "%s,\"%s\",\"%s\",\"%s\",%lld,%lld,%lld,\"%s\",\"%s\",%d,%d,%d,%d,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.6f,%.6f\n",
+                timestamp, host.c_str(), cpu.c_str(), matrix.c_str(), r.rows, r.columns, r.nnz, kernel.c_str(),
+                schedule.c_str(), r.threads, r.ranks, r.vectors, r.warmup, s.n, s.min, s.median, s.mean, s.max,
+                s.stddev, s.p10, s.p90, s.ci_low, s.ci_high, bench_gflops(r), bench_bandwidth(r));
+    }
+    return fclose(f) != 0;
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef BUCKET_CSR_H
+#define BUCKET_CSR_H
+
+/*
+ * CSR WITH ROW-LENGTH BUCKETS AND TEMPLATED KERNELS (--kernel=bucketed)
+ *
+ * The inner loop of the CSR kernel has an unknown trip count, so every row pays the loop control and the
+ * compiler cannot unroll it. FEM and flow matrices have most rows of a few fixed lengths (7 or 27 for 3D
+ * stencils, multiples of the block size for systems of equations), so here:
+ *   - the row lengths are counted once (histogram over BUCKET_LENGTHS) and every length with at least
+ *     BUCKET_MIN_SHARE of the rows gets a bucket; its rows are stored one after the other (row i of the bucket
+ *     at entries [i*L, (i+1)*L), no rows_ptr) and computed by spmv_bucket_rows<L>, whose row sum is unrolled at
+ *     compile time (same order of the additions as the CSR loop, so the result is the same);
+ *   - the other rows stay in a CSR of the remaining rows, computed by the generic loop.
+ * The kernels are templates over the column index type (uint16_t when the matrix has at most 65536 columns,
+ * int otherwise: 2 bytes per nonzero less to read) and over the value type (double, or float with
+ * --precision=float). All the buckets are computed in one parallel region, one orphaned "omp for
+ * schedule(runtime) nowait" each (the rows of different buckets are disjoint).
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+
+//row lengths with an unrolled kernel (each one is instantiated for 2 index types x 2 value types)
+static const int BUCKET_LENGTHS[] = {2, 3, 4, 5, 6, 7, 8, 9, 12, 16, 18, 24, 27};
+#define BUCKET_N_LENGTHS 13
+#define BUCKET_MAX_LENGTH 27
+#define BUCKET_MIN_SHARE 0.01       //share of the rows needed to get a bucket
+
+struct RowBucket {
+    int length;             //entries of every row (0 = generic rows)
+    int first_row;          //range of the bucket in BucketCsr::rows
+    int n_rows;
+    long long first_entry;  //first entry of the bucket in cols/values
+};
+
+struct BucketCsr {
+    const CSRMatrix* csr;
+    int index_bits;                 //16 or 32
+    int value_float;                //1 if the values are stored in float
+    std::vector<RowBucket> buckets; //the buckets, then the generic rows
+    std::vector<int> rows;          //rows of every bucket, in order
+    std::vector<long long> generic_ptr;     //entries of the generic rows, relative to their first_entry
+    std::vector<uint16_t> cols16;
+    std::vector<int> cols32;
+    std::vector<double> values64;
+    std::vector<float> values32;
+};
+
+/*SUM OF ONE ROW OF LEN ENTRIES, UNROLLED: ((0 + a0*x0) + a1*x1) + ... AS IN THE CSR LOOP*/
+template <int LEN, typename IT, typename VT>
+struct FixedRow {
+    static inline double sum(const IT* cols, const VT* values, const double* x) {
+        return FixedRow<LEN - 1, IT, VT>::sum(cols, values, x) + (double)values[LEN - 1] * x[cols[LEN - 1]];
+    }
+};
+
+template <typename IT, typename VT>
+struct FixedRow<0, IT, VT> {
+    static inline double sum(const IT*, const VT*, const double*) { return 0.0; }
+};
+
+//rows of one bucket (called inside the parallel region)
+template <int LEN, typename IT, typename VT>
+static inline void spmv_bucket_rows(int n_rows, const int* rows, const IT* cols, const VT* values, const double* x, double* y) {
+    #pragma omp for schedule(runtime) nowait
+    for (int i = 0; i < n_rows; i++) {
+        size_t base = (size_t)i * LEN;
+        y[rows[i]] = FixedRow<LEN, IT, VT>::sum(cols + base, values + base, x);
+    }
+}
+
+//rows of any length (called inside the parallel region)
+template <typename IT, typename VT>
+static inline void spmv_generic_rows(int n_rows, const int* rows, const long long* ptr, const IT* cols, const VT* values,
+                                     const double* x, double* y) {
+    #pragma omp for schedule(runtime) nowait
+    for (int i = 0; i < n_rows; i++) {
+        double sum = 0.0;
+        for (long long idx = ptr[i]; idx < ptr[i + 1]; idx++)
+            sum += (double)values[idx] * x[cols[idx]];
+        y[rows[i]] = sum;
+    }
+}
+
+template <typename IT, typename VT>
+static inline void spmv_buckets(const BucketCsr& b, const IT* cols, const VT* values, const double* x, double* y) {
+    #pragma omp parallel
+    {
+        for (size_t k = 0; k < b.buckets.size(); k++) {
+            const RowBucket& bk = b.buckets[k];
+            const int* rows = b.rows.data() + bk.first_row;
+            const IT* c = cols + bk.first_entry;
+            const VT* v = values + bk.first_entry;
+            switch (bk.length) {
+                case 2: spmv_bucket_rows<2>(bk.n_rows, rows, c, v, x, y); break;
+                case 3: spmv_bucket_rows<3>(bk.n_rows, rows, c, v, x, y); break;
+                case 4: spmv_bucket_rows<4>(bk.n_rows, rows, c, v, x, y); break;
+                case 5: spmv_bucket_rows<5>(bk.n_rows, rows, c, v, x, y); break;
+                case 6: spmv_bucket_rows<6>(bk.n_rows, rows, c, v, x, y); break;
+                case 7: spmv_bucket_rows<7>(bk.n_rows, rows, c, v, x, y); break;
+                case 8: spmv_bucket_rows<8>(bk.n_rows, rows, c, v, x, y); break;
+                case 9: spmv_bucket_rows<9>(bk.n_rows, rows, c, v, x, y); break;
+                case 12: spmv_bucket_rows<12>(bk.n_rows, rows, c, v, x, y); break;
+                case 16: spmv_bucket_rows<16>(bk.n_rows, rows, c, v, x, y); break;
+                case 18: spmv_bucket_rows<18>(bk.n_rows, rows, c, v, x, y); break;
+                case 24: spmv_bucket_rows<24>(bk.n_rows, rows, c, v, x, y); break;
+                case 27: spmv_bucket_rows<27>(bk.n_rows, rows, c, v, x, y); break;
+                default: spmv_generic_rows(bk.n_rows, rows, b.generic_ptr.data(), c, v, x, y); break;
+            }
+        }
+    }
+}
+
+/*CREATION OF THE BUCKETS FROM THE CSR MATRIX (value_float: VALUES STORED IN float)*/
+static inline void build_buckets(const CSRMatrix& csr, int value_float, BucketCsr& b) {
+    const int* rows_ptr = csr.rows_ptr;
+    int rows_number = csr.rows_number;
+
+    b.csr = &csr;
+    b.index_bits = csr.columns_number <= 65536 ? 16 : 32;
+    b.value_float = value_float;
+
+    //histogram of the row lengths up to BUCKET_MAX_LENGTH
+    long long histogram[BUCKET_MAX_LENGTH + 1] = {0};
+    #pragma omp parallel for schedule(static) reduction(+:histogram[:BUCKET_MAX_LENGTH + 1])
+    for (int r = 0; r < rows_number; r++) {
+        int len = rows_ptr[r + 1] - rows_ptr[r];
+        if (len <= BUCKET_MAX_LENGTH) histogram[len]++;
+    }
+
+    //bucket of every length (-1: generic), the generic rows are the last bucket
+    int bucket_of[BUCKET_MAX_LENGTH + 1];
+    std::fill(bucket_of, bucket_of + BUCKET_MAX_LENGTH + 1, -1);
+    b.buckets.clear();
+    for (int i = 0; i < BUCKET_N_LENGTHS; i++) {
+        int len = BUCKET_LENGTHS[i];
+        if (histogram[len] > 0 && histogram[len] >= BUCKET_MIN_SHARE * rows_number) {
+            RowBucket bk = {len, 0, (int)histogram[len], 0};
+            bucket_of[len] = (int)b.buckets.size();
+            b.buckets.push_back(bk);
+        }
+    }
+    RowBucket generic = {0, 0, rows_number, 0};
+    for (size_t k = 0; k < b.buckets.size(); k++) generic.n_rows -= b.buckets[k].n_rows;
+    int generic_index = (int)b.buckets.size();
+    b.buckets.push_back(generic);
+
+    //ranges of rows and entries of every bucket
+    int row = 0;
+    long long entry = 0;
+    for (size_t k = 0; k + 1 < b.buckets.size(); k++) {
+        b.buckets[k].first_row = row;
+        b.buckets[k].first_entry = entry;
+        row += b.buckets[k].n_rows;
+        entry += (long long)b.buckets[k].n_rows * b.buckets[k].length;
+    }
+    b.buckets[generic_index].first_row = row;
+    b.buckets[generic_index].first_entry = entry;
+
+    //position of every row (in row order inside a bucket) and where its entries go
+    b.rows.resize(rows_number);
+    b.generic_ptr.assign(b.buckets[generic_index].n_rows + 1, 0);
+    std::vector<long long> destination(rows_number);
+    std::vector<int> cursor(b.buckets.size(), 0);
+    for (int r = 0; r < rows_number; r++) {
+        int len = rows_ptr[r + 1] - rows_ptr[r];
+        int k = len <= BUCKET_MAX_LENGTH && bucket_of[len] >= 0 ? bucket_of[len] : generic_index;
+        RowBucket& bk = b.buckets[k];
+        int i = cursor[k]++;
+        b.rows[bk.first_row + i] = r;
+        if (k == generic_index) {
+            destination[r] = bk.first_entry + b.generic_ptr[i];
+            b.generic_ptr[i + 1] = b.generic_ptr[i] + len;
+        }
+        else
+            destination[r] = bk.first_entry + (long long)i * len;
+    }
+
+    //copy of the entries in the chosen types
+    long long nnz = csr.nnz;
+    if (b.index_bits == 16) b.cols16.resize(nnz);
+    else b.cols32.resize(nnz);
+    if (value_float) b.values32.resize(nnz);
+    else b.values64.resize(nnz);
+
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < rows_number; r++) {
+        long long d = destination[r];
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++, d++) {
+            if (b.index_bits == 16) b.cols16[d] = (uint16_t)csr.cols[idx];
+            else b.cols32[d] = csr.cols[idx];
+            if (value_float) b.values32[d] = (float)csr.values[idx];
+            else b.values64[d] = csr.values[idx];
+        }
+    }
+}
+
+/*y = A*x WITH THE INSTANTIATION OF THE STORED TYPES*/
+static inline void spmv_bucketed(const BucketCsr& b, const double* x, double* y) {
+    if (b.index_bits == 16) {
+        if (b.value_float) spmv_buckets(b, b.cols16.data(), b.values32.data(), x, y);
+        else spmv_buckets(b, b.cols16.data(), b.values64.data(), x, y);
+    }
+    else {
+        if (b.value_float) spmv_buckets(b, b.cols32.data(), b.values32.data(), x, y);
+        else spmv_buckets(b, b.cols32.data(), b.values64.data(), x, y);
+    }
+}
+
+//buckets and share of the rows, on stderr
+static inline void bucket_report(const BucketCsr& b) {
+    int rows_number = b.csr->rows_number;
+    fprintf(stderr, "[BUCKETS] %d-bit indices, %s values |", b.index_bits, b.value_float ? "float" : "double");
+    for (size_t k = 0; k < b.buckets.size(); k++) {
+        const RowBucket& bk = b.buckets[k];
+        if (bk.length) fprintf(stderr, " length %d: %d rows", bk.length, bk.n_rows);
+        else fprintf(stderr, " generic: %d rows", bk.n_rows);
+        fprintf(stderr, " (%.1f%%)%s", rows_number ? 100.0 * bk.n_rows / rows_number : 0.0, k + 1 < b.buckets.size() ? " |" : "\n");
+    }
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef CG_H
+#define CG_H
+
+/*
+ * CONJUGATE GRADIENT ON THE CSR MATRIX (--solver=cg), FOR SYMMETRIC POSITIVE DEFINITE MATRICES
+ *
+ * One iteration of the textbook CG is an SpMV, two dot products and three vector updates, i.e. six passes over
+ * vectors of n doubles besides the matrix. Here the passes are fused so every iteration makes three:
+ *   1. Ap = A*p and p.Ap in the same loop over the rows (p[r] * Ap[r] is added as soon as row r is done);
+ *   2. x += alpha*p, r -= alpha*Ap and r.r in the same loop;
+ *   3. p = r + beta*p.
+ * Each fused loop returns the local part of its reduction, so the distributed version (Deliverable_2, rows split
+ * between the processes) needs one MPI_Allreduce per fused reduction, two per iteration.
+ * The loops take raw arrays: the OpenMP binaries pass the whole CSR matrix and p itself as the gathered vector,
+ * the MPI one passes its local rows with the columns remapped into the gathered p.
+ *
+ * The benchmark solves A*x = b with b = A*random_array, starting from x = 0, until ||r|| <= tolerance * ||b||
+ * or the maximum number of iterations; the error against random_array (the exact solution) is also reported.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include "csr_matrix.h"
+#include "spmv_options.h"
+
+struct CgResult {
+    int iterations;
+    double residual;        //||r|| / ||b|| at the end
+};
+
+/*Ap = A*p ON rows ROWS (p_gathered INDEXED BY cols) AND RETURNS THE LOCAL p.Ap (p[r] IS THE p OF ROW r)*/
+static inline double cg_spmv_dot(int rows, const int* rows_ptr, const int* cols, const double* values,
+                                 const double* p_gathered, const double* p, double* Ap) {
+    double pAp = 0.0;
+    #pragma omp parallel for schedule(runtime) reduction(+:pAp)
+    for (int r = 0; r < rows; r++) {
+        double sum = 0.0;
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++)
+            sum += values[idx] * p_gathered[cols[idx]];
+        Ap[r] = sum;
+        pAp += p[r] * sum;
+    }
+    return pAp;
+}
+
+/*x += alpha*p, r -= alpha*Ap AND RETURNS THE LOCAL r.r*/
+static inline double cg_update(int n, double alpha, const double* p, const double* Ap, double* x, double* r) {
+    double rr = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:rr)
+    for (int i = 0; i < n; i++) {
+        x[i] += alpha * p[i];
+        double ri = r[i] - alpha * Ap[i];
+        r[i] = ri;
+        rr += ri * ri;
+    }
+    return rr;
+}
+
+/*p = r + beta*p*/
+static inline void cg_direction(int n, double beta, const double* r, double* p) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+        p[i] = r[i] + beta * p[i];
+}
+
+static inline double cg_dot(int n, const double* a, const double* b) {
+    double sum = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:sum)
+    for (int i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+/*SOLUTION OF A*x = b FROM x = 0 (SHARED MEMORY)*/
+static inline CgResult cg_solve(const CSRMatrix& csr, const double* b, double* x, int max_iterations, double tolerance) {
+    int n = csr.rows_number;
+    std::vector<double> r(b, b + n), p(b, b + n), Ap(n);
+    for (int i = 0; i < n; i++) x[i] = 0.0;
+
+    double rr = cg_dot(n, r.data(), r.data());
+    double rr0 = rr, stop = tolerance * tolerance * rr0;
+    CgResult result;
+    result.iterations = 0;
+
+    while (result.iterations < max_iterations && rr > stop) {
+        double pAp = cg_spmv_dot(n, csr.rows_ptr, csr.cols, csr.values, p.data(), p.data(), Ap.data());
+        if (pAp == 0.0) break;      //breakdown (singular matrix)
+        double alpha = rr / pAp;
+        double rr_new = cg_update(n, alpha, p.data(), Ap.data(), x, r.data());
+        cg_direction(n, rr_new / rr, r.data(), p.data());
+        rr = rr_new;
+        result.iterations++;
+    }
+    result.residual = rr0 > 0.0 ? sqrt(rr / rr0) : 0.0;
+    return result;
+}
+
+/*
+ * CG BENCHMARK OF THE OpenMP BINARIES: b = A*x_true (OUTSIDE THE TIMED REGION), TIMED SOLUTION, THEN
+ * matrix:cpu time:real time:cg:iterations:relative residual:relative error against x_true
+ */
+static inline void cg_run(const char* filename, const SpmvOptions& opts, const CSRMatrix& csr, const double* x_true) {
+    int n = csr.rows_number;
+    std::vector<double> b(n), x(n);
+    cg_spmv_dot(n, csr.rows_ptr, csr.cols, csr.values, x_true, x_true, b.data());
+
+    struct timespec start, end;
+    clock_t start2 = clock();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    CgResult result = cg_solve(csr, b.data(), x.data(), opts.cg_iterations, opts.cg_tolerance);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clock_t end2 = clock();
+
+    double error = 0.0, norm = 0.0;
+    for (int i = 0; i < n; i++) {
+        error += (x[i] - x_true[i]) * (x[i] - x_true[i]);
+        norm += x_true[i] * x_true[i];
+    }
+    printf("%s:%.6f:%.6f:cg:%d:%.3e:%.3e\n", filename, (double)(end2 - start2) / CLOCKS_PER_SEC,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, result.iterations, result.residual,
+           norm > 0.0 ? sqrt(error / norm) : sqrt(error));
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef COLUMN_TILES_H
+#define COLUMN_TILES_H
+
+/*
+ * COLUMN-TILED (CACHE-BLOCKED) CSR SpMV (--kernel=tiled)
+ *
+ * When x is much larger than the last level cache (nlpkkt240: 28M doubles = 224 MB), the gathers x[cols[idx]]
+ * of consecutive rows touch lines that have already been evicted, so almost every gather can be a miss. Here
+ * the columns are split into panels of panel_width columns, with panel_width * 8 bytes = half of the cache (the
+ * other half is left to the streams of the matrix and of y), and every thread computes its rows panel by panel:
+ *     for every panel p:  for every row r of the thread:  y[r] += sum of the entries of row r in the columns of p
+ * All the threads work on the same panel at about the same time, so the slice of x they gather from stays in the
+ * cache; the price is that y is read and written once per panel instead of once.
+ *
+ * The tiles are built once from the CSR matrix (a copy of cols/values in panel order) and kept with the kernel:
+ *   - segment s = the entries of one row inside one panel: seg_row[s], entries [seg_ptr[s], seg_ptr[s+1]);
+ *   - the segments are ordered by panel, then by row, and the rows are split between the threads with the
+ *     nnz-balanced partition of row_partition.h, so the segments of thread t in panel p are the contiguous range
+ *     [first_seg[p*(T+1) + t], first_seg[p*(T+1) + t + 1]) and every thread only writes its own rows of y.
+ * The cache size is read from sysfs (the largest data/unified cache of cpu0), or given with --cache-size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+#include "row_partition.h"
+
+#define TILES_DEFAULT_CACHE (1 << 20)       //cache assumed when it cannot be detected
+
+struct TiledCsr {
+    const CSRMatrix* csr;
+    long long cache_bytes;          //cache the panels are sized for
+    int panel_width;                //columns per panel
+    int n_panels;
+    RowPartition partition;         //rows of every thread
+    std::vector<long long> first_seg;   //first segment of every (panel, thread): n_panels * (T+1)
+    std::vector<int> seg_row;       //row of every segment
+    std::vector<long long> seg_ptr; //entries of every segment (n_segments + 1)
+    std::vector<int> cols;          //columns and values in panel order
+    std::vector<double> values;
+};
+
+//size in bytes of the largest data or unified cache of cpu0 (sysfs, then sysconf), 0 if unknown
+static inline long long detect_cache_size() {
+    long long best = 0;
+    for (int index = 0; index < 16; index++) {
+        char path[128], type[32] = "", size[32] = "";
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        FILE* f = fopen(path, "r");
+        if (!f) break;
+        if (fscanf(f, "%31s", type) != 1) type[0] = '\0';
+        fclose(f);
+        if (strcmp(type, "Instruction") == 0) continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        f = fopen(path, "r");
+        if (!f) continue;
+        if (fscanf(f, "%31s", size) == 1) {
+            char* end;
+            long long bytes = strtoll(size, &end, 10);
+            if (*end == 'K') bytes <<= 10;
+            else if (*end == 'M') bytes <<= 20;
+            best = std::max(best, bytes);
+        }
+        fclose(f);
+    }
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    if (best <= 0) best = std::max(sysconf(_SC_LEVEL3_CACHE_SIZE), sysconf(_SC_LEVEL2_CACHE_SIZE));
+#endif
+    return best > 0 ? best : 0;
+}
+
+/*CREATION OF THE TILES FROM THE CSR MATRIX (cache_bytes = 0: DETECTED)*/
+static inline void build_tiles(const CSRMatrix& csr, long long cache_bytes, TiledCsr& t) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+
+    t.csr = &csr;
+    if (cache_bytes <= 0) cache_bytes = detect_cache_size();
+    if (cache_bytes <= 0) cache_bytes = TILES_DEFAULT_CACHE;
+    t.cache_bytes = cache_bytes;
+    t.panel_width = (int)std::max(1LL, std::min(cache_bytes / 2 / (long long)sizeof(double), (long long)std::max(csr.columns_number, 1)));
+    t.n_panels = std::max(1, (csr.columns_number + t.panel_width - 1) / t.panel_width);
+
+    build_row_partition(csr, t.partition);
+    int T = t.partition.n_threads, P = t.n_panels, W = t.panel_width;
+    const int* row_start = t.partition.row_start.data();
+
+    //segments and entries of every (panel, thread): the columns of a row are sorted, so its panels are in order
+    std::vector<long long> seg_count((size_t)P * (T + 1), 0), nnz_count((size_t)P * (T + 1), 0);
+    #pragma omp parallel for schedule(static, 1) num_threads(T)
+    for (int th = 0; th < T; th++) {
+        for (int r = row_start[th]; r < row_start[th + 1]; r++) {
+            int last_panel = -1;
+            for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+                int p = cols[idx] / W;
+                if (p != last_panel) seg_count[(size_t)p * (T + 1) + th]++;
+                nnz_count[(size_t)p * (T + 1) + th]++;
+                last_panel = p;
+            }
+        }
+    }
+
+    //exclusive scan in (panel, thread) order: the start of every range of segments and of entries
+    long long segs = 0, entries = 0;
+    for (size_t i = 0; i < seg_count.size(); i++) {
+        long long s = seg_count[i], e = nnz_count[i];
+        seg_count[i] = segs;
+        nnz_count[i] = entries;
+        segs += s;
+        entries += e;
+    }
+    t.first_seg = seg_count;
+    t.first_seg.push_back(segs);
+    t.seg_row.resize(segs);
+    t.seg_ptr.resize(segs + 1);
+    t.seg_ptr[segs] = entries;
+    t.cols.resize(entries);
+    t.values.resize(entries);
+
+    //scatter: every thread fills its own ranges (seg_count and nnz_count are now its cursors)
+    #pragma omp parallel for schedule(static, 1) num_threads(T)
+    for (int th = 0; th < T; th++) {
+        for (int r = row_start[th]; r < row_start[th + 1]; r++) {
+            int last_panel = -1;
+            long long* seg_cursor = NULL;
+            long long* nnz_cursor = NULL;
+            for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+                int p = cols[idx] / W;
+                if (p != last_panel) {
+                    seg_cursor = &seg_count[(size_t)p * (T + 1) + th];
+                    nnz_cursor = &nnz_count[(size_t)p * (T + 1) + th];
+                    t.seg_row[*seg_cursor] = r;
+                    t.seg_ptr[*seg_cursor] = *nnz_cursor;
+                    (*seg_cursor)++;
+                    last_panel = p;
+                }
+                t.cols[*nnz_cursor] = cols[idx];
+                t.values[*nnz_cursor] = values[idx];
+                (*nnz_cursor)++;
+            }
+        }
+    }
+}
+
+/*y = A*x PANEL BY PANEL, EVERY THREAD ON ITS OWN ROWS*/
+static inline void spmv_tiled(const TiledCsr& t, const double* x, double* y) {
+    const int* seg_row = t.seg_row.data();
+    const long long* seg_ptr = t.seg_ptr.data();
+    const long long* first_seg = t.first_seg.data();
+    const int* cols = t.cols.data();
+    const double* values = t.values.data();
+    int T = t.partition.n_threads;
+
+    #pragma omp parallel for schedule(static, 1) num_threads(T)
+    for (int th = 0; th < T; th++) {
+        for (int r = t.partition.row_start[th]; r < t.partition.row_start[th + 1]; r++) y[r] = 0.0;
+
+        for (int p = 0; p < t.n_panels; p++) {
+            long long from = first_seg[(size_t)p * (T + 1) + th], to = first_seg[(size_t)p * (T + 1) + th + 1];
+            for (long long s = from; s < to; s++) {
+                double sum = 0.0;
+                for (long long idx = seg_ptr[s]; idx < seg_ptr[s + 1]; idx++)
+                    sum += values[idx] * x[cols[idx]];
+                y[seg_row[s]] += sum;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef CSR_CACHE_H
+#define CSR_CACHE_H
+
+/*
+ * BINARY CSR CACHE
+ *
+ * The matrices never change between the testing sessions of the PBS scripts, so the first run writes the
+ * CSR arrays next to the .mtx file (matrix.mtx -> matrix.csr) and the following runs map that file and use
+ * the arrays in place: no parsing, no sorting and no copying, the setup cost is just the page-in.
+ *
+ * File layout (version 1):
+ *   [CsrCacheHeader, 128 bytes][rows_ptr][cols][values]
+ * every section starts at a 64-byte aligned offset (mmap returns page-aligned memory, so the arrays are
+ * cache-line aligned in memory too).
+ *
+ * The cache is rebuilt when the .mtx is newer/different (size and mtime are stored in the header), when
+ * the version or the index/value widths don't match, or when the header checksum is wrong.
+ * The half storage of a symmetric matrix (lower triangle only, see load_csr) has its own cache, matrix.lower.csr.
+ * Environment variables:
+ *   SPMV_CSR_CACHE=0       never read nor write the cache
+ *   SPMV_CACHE_VERIFY=1    also verify the checksum of the data sections (one extra pass over the arrays)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mtx_parser.h"
+#include "csr_matrix.h"
+
+#define CSR_CACHE_MAGIC "SPMVCSR1"
+#define CSR_CACHE_VERSION 1
+#define CSR_CACHE_ALIGN 64
+
+struct CsrCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    int64_t rows_number;
+    int64_t columns_number;
+    int64_t nnz;
+    int32_t is_symmetric;
+    uint32_t index_width;       //sizeof(int) of the writer
+    uint32_t value_width;       //sizeof(double) of the writer
+    uint32_t half_storage;      //1 = lower triangle of a symmetric matrix (0 in the caches written before it existed)
+    uint64_t rows_ptr_offset;
+    uint64_t cols_offset;
+    uint64_t values_offset;
+    uint64_t file_size;
+    int64_t source_size;        //size and modification time of the .mtx the cache was built from
+    int64_t source_mtime;
+    uint64_t data_checksum;     //checksum of the three sections
+    uint64_t padding;           //keeps the header 128 bytes long
+    uint64_t header_checksum;   //checksum of all the previous fields
+};
+
+static_assert(sizeof(CsrCacheHeader) == 128, "CsrCacheHeader must be 128 bytes");
+
+static inline uint64_t csr_cache_align(uint64_t offset) {
+    return (offset + CSR_CACHE_ALIGN - 1) / CSR_CACHE_ALIGN * CSR_CACHE_ALIGN;
+}
+
+/*
+ * Position-dependent checksum over 64-bit words: sum of mix(word_i) * (2i + 1).
+ * Unlike FNV it is a plain sum, so it can be computed with an OpenMP reduction.
+ */
+static inline uint64_t csr_cache_checksum(const void* data, size_t bytes, uint64_t seed) {
+    const unsigned char* p = (const unsigned char*)data;
+    long long words = (long long)(bytes / 8);
+    uint64_t sum = 0;
+
+    #pragma omp parallel for schedule(static) reduction(+:sum)
+    for (long long i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, p + 8 * i, 8);
+        w ^= w >> 29;
+        w *= 0xbf58476d1ce4e5b9ULL;
+        w ^= w >> 32;
+        sum += w * (2 * (uint64_t)i + 1);
+    }
+    //tail bytes
+    for (size_t i = (size_t)words * 8; i < bytes; i++)
+        sum += (uint64_t)p[i] * 0x9e3779b97f4a7c15ULL * (i + 1);
+
+    return sum ^ (seed * 0x9e3779b97f4a7c15ULL);
+}
+
+static inline uint64_t csr_cache_header_checksum(const CsrCacheHeader& h) {
+    return csr_cache_checksum(&h, offsetof(CsrCacheHeader, header_checksum), 0);
+}
+
+static inline uint64_t csr_cache_data_checksum(const CSRMatrix& csr) {
+    uint64_t sum = csr_cache_checksum(csr.rows_ptr, (size_t)(csr.rows_number + 1) * sizeof(int), 1);
+    sum += csr_cache_checksum(csr.cols, (size_t)csr.nnz * sizeof(int), 2);
+    sum += csr_cache_checksum(csr.values, (size_t)csr.nnz * sizeof(double), 3);
+    return sum;
+}
+
+//matrix.mtx -> matrix.csr (matrix.lower.csr for the half storage)
+static inline std::string csr_cache_path(const char* mtx_filename, int half_storage) {
+    std::string path(mtx_filename);
+    size_t len = path.size();
+    if (len > 4 && path.compare(len - 4, 4, ".mtx") == 0) path.resize(len - 4);
+    return path + (half_storage ? ".lower.csr" : ".csr");
+}
+
+static inline int csr_cache_enabled() {
+    const char* env = getenv("SPMV_CSR_CACHE");
+    return !(env && strcmp(env, "0") == 0);
+}
+
+/*WRITES THE CACHE (TO A TEMPORARY FILE, RENAMED AT THE END SO THAT A CONCURRENT READER NEVER SEES HALF A FILE)*/
+static inline int csr_cache_write(const char* cache_path, const CSRMatrix& csr, const struct stat* source) {
+    CsrCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CSR_CACHE_MAGIC, 8);
+    h.version = CSR_CACHE_VERSION;
+    h.header_size = sizeof(CsrCacheHeader);
+    h.rows_number = csr.rows_number;
+    h.columns_number = csr.columns_number;
+    h.nnz = csr.nnz;
+    h.is_symmetric = csr.is_symmetric;
+    h.half_storage = csr.half_storage;
+    h.index_width = sizeof(int);
+    h.value_width = sizeof(double);
+    h.rows_ptr_offset = csr_cache_align(sizeof(CsrCacheHeader));
+    h.cols_offset = csr_cache_align(h.rows_ptr_offset + (uint64_t)(csr.rows_number + 1) * sizeof(int));
+    h.values_offset = csr_cache_align(h.cols_offset + (uint64_t)csr.nnz * sizeof(int));
+    h.file_size = h.values_offset + (uint64_t)csr.nnz * sizeof(double);
+    if (source) {
+        h.source_size = source->st_size;
+        h.source_mtime = source->st_mtime;
+    }
+    h.data_checksum = csr_cache_data_checksum(csr);
+    h.header_checksum = csr_cache_header_checksum(h);
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", cache_path, (int)getpid());
+    FILE* out = fopen(tmp_path, "wb");
+    if (!out) return 1;
+
+    static const char zeros[CSR_CACHE_ALIGN] = {0};
+    uint64_t written = 0;
+    int ok = 1;
+    struct Section { const void* data; uint64_t offset, bytes; } sections[4] = {
+        {&h, 0, sizeof(h)},
+        {csr.rows_ptr, h.rows_ptr_offset, (uint64_t)(csr.rows_number + 1) * sizeof(int)},
+        {csr.cols, h.cols_offset, (uint64_t)csr.nnz * sizeof(int)},
+        {csr.values, h.values_offset, (uint64_t)csr.nnz * sizeof(double)}
+    };
+    for (int s = 0; s < 4 && ok; s++) {
+        //padding up to the aligned offset of the section
+        ok = fwrite(zeros, 1, sections[s].offset - written, out) == sections[s].offset - written;
+        if (ok && sections[s].bytes) ok = fwrite(sections[s].data, 1, sections[s].bytes, out) == sections[s].bytes;
+        written = sections[s].offset + sections[s].bytes;
+    }
+    ok = (fclose(out) == 0) && ok;
+
+    if (!ok || rename(tmp_path, cache_path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * MAPS THE CACHE AND POINTS THE CSR ARRAYS INTO IT.
+ * Returns 0 on success, 1 if the cache is missing, stale or invalid (the caller rebuilds it).
+ */
+static inline int csr_cache_map(const char* cache_path, CSRMatrix& csr, const struct stat* source) {
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0) return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CsrCacheHeader)) {
+        close(fd);
+        return 1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    const CsrCacheHeader& h = *(const CsrCacheHeader*)map;
+    int valid = memcmp(h.magic, CSR_CACHE_MAGIC, 8) == 0
+             && h.version == CSR_CACHE_VERSION
+             && h.header_size == sizeof(CsrCacheHeader)
+             && h.header_checksum == csr_cache_header_checksum(h)
+             && h.index_width == sizeof(int)
+             && h.value_width == sizeof(double)
+             && h.file_size == (uint64_t)st.st_size
+             && (!source || (h.source_size == source->st_size && h.source_mtime == source->st_mtime));
+    if (!valid) {
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    const char* base = (const char*)map;
+    csr.rows_number = (int)h.rows_number;
+    csr.columns_number = (int)h.columns_number;
+    csr.nnz = (int)h.nnz;
+    csr.is_symmetric = h.is_symmetric;
+    csr.half_storage = h.half_storage;
+    csr.rows_ptr = (const int*)(base + h.rows_ptr_offset);
+    csr.cols = (const int*)(base + h.cols_offset);
+    csr.values = (const double*)(base + h.values_offset);
+    csr.map_base = map;
+    csr.map_size = st.st_size;
+
+    //the kernel reads the whole file anyway: start the page-in now
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    const char* verify = getenv("SPMV_CACHE_VERIFY");
+    if (verify && strcmp(verify, "1") == 0 && csr_cache_data_checksum(csr) != h.data_checksum) {
+        fprintf(stderr, "[ERR] Checksum mismatch in %s, rebuilding it\n", cache_path);
+        munmap(map, st.st_size);
+        csr.map_base = NULL;
+        csr.rows_ptr = NULL;
+        csr.cols = NULL;
+        csr.values = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * LOADS THE MATRIX IN CSR FORMAT: FROM THE CACHE IF IT IS VALID, OTHERWISE PARSING THE .mtx (AND WRITING THE CACHE)
+ *
+ * With half_storage set, a symmetric (or skew-symmetric) matrix is NOT expanded: only the lower triangle and the
+ * diagonal are kept (entries written in the upper triangle are moved to the lower one, negated if skew-symmetric)
+ * and csr.half_storage is set. A general matrix is loaded in full storage anyway, so the caller must check csr.half_storage.
+ */
+static inline int load_csr(const char* filename, CSRMatrix& csr, int half_storage = 0) {
+    int use_cache = csr_cache_enabled();
+
+    struct stat source;
+    int has_source = stat(filename, &source) == 0;
+
+    if (use_cache && csr_cache_map(csr_cache_path(filename, half_storage).c_str(), csr, has_source ? &source : NULL) == 0)
+        return 0;
+    //half storage requested but the matrix is general: its full cache is the right one
+    if (use_cache && half_storage && csr_cache_map(csr_cache_path(filename, 0).c_str(), csr, has_source ? &source : NULL) == 0) {
+        if (csr.is_symmetric == MTX_GENERAL) return 0;
+        munmap(csr.map_base, csr.map_size);
+        csr.map_base = NULL;
+    }
+
+    MtxHeader header;
+    std::vector<Node> matrix;
+    if (mtx_load(filename, header, matrix, !half_storage) != 0)
+        return 1;
+
+    int half = half_storage && header.is_symmetric != MTX_GENERAL;
+    if (half) {
+        double sign = header.is_symmetric == MTX_SKEW_SYMMETRIC ? -1.0 : 1.0;
+        long long n_elements = (long long)matrix.size();
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < n_elements; i++) {
+            if (matrix[i].col > matrix[i].row) {
+                std::swap(matrix[i].row, matrix[i].col);
+                matrix[i].value *= sign;
+            }
+        }
+    }
+
+    build_csr(matrix, header, csr);
+    csr.half_storage = half;
+    std::string cache_path = csr_cache_path(filename, half);
+
+    if (use_cache && csr_cache_write(cache_path.c_str(), csr, has_source ? &source : NULL) != 0)
+        fprintf(stderr, "[ERR] Could not write the CSR cache %s (the matrix will be parsed again next time)\n", cache_path.c_str());
+
+    return 0;
+}
+
+#endif
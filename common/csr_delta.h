@@ -0,0 +1,145 @@
+#ifndef CSR_DELTA_H
+#define CSR_DELTA_H
+
+/*
+ * CSR WITH COMPRESSED COLUMN INDICES
+ *
+ * With 4-byte indices and 8-byte values a third of the CSR stream is indices. Here every row stores a base
+ * (its first column) and the columns as offsets from it; the rows are grouped in chunks of DELTA_CHUNK_ROWS and
+ * every chunk uses the smallest width that fits the span (last column - first column) of all its rows:
+ *   1 byte  if every span is < 256
+ *   2 bytes if every span is < 65536 (every row of a banded matrix with bandwidth < 65536)
+ *   4 bytes otherwise (escape: absolute int columns, base 0)
+ * Offsets from the row base (not from the previous column) keep the entries independent, so the decoding
+ * is one load + add per entry and the inner loop is the same as CSR. Every width has its own typed array and
+ * the indices of a chunk are contiguous in it, so the position of a row is the offset of its chunk plus its
+ * distance from the first row of the chunk in rows_ptr: the extra bytes are 4 per row (the base) and 9 per chunk.
+ * rows_ptr and values are the ones of the CSR matrix (not copied), only the index stream changes.
+ */
+
+#include <stdint.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+
+#define DELTA_CHUNK_ROWS 32
+
+struct DeltaCsr {
+    const CSRMatrix* csr;
+    std::vector<int> row_base;                  //first column of every row (0 in the escape chunks)
+    std::vector<unsigned char> chunk_width;     //bytes per index of every chunk: 1, 2 or 4
+    std::vector<long long> chunk_offset;        //position of the first index of every chunk in the array of its width
+    std::vector<uint8_t> idx8;                  //index streams, one per width
+    std::vector<uint16_t> idx16;
+    std::vector<int32_t> idx32;
+    long long rows_per_width[5];                //statistics: number of rows stored with 1, 2 and 4 bytes
+};
+
+/*CREATION OF THE COMPRESSED INDICES FROM THE CSR MATRIX*/
+static inline void build_delta(const CSRMatrix& csr, DeltaCsr& d) {
+    int rows_number = csr.rows_number;
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    int n_chunks = (rows_number + DELTA_CHUNK_ROWS - 1) / DELTA_CHUNK_ROWS;
+
+    d.csr = &csr;
+    d.row_base.resize(rows_number);
+    d.chunk_width.resize(n_chunks);
+    d.chunk_offset.resize(n_chunks);
+
+    //width of every chunk (the columns of a row are sorted, so the span is last - first)
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < n_chunks; c++) {
+        int last_row = std::min(rows_number, (c + 1) * DELTA_CHUNK_ROWS);
+        int width = 1;
+        for (int r = c * DELTA_CHUNK_ROWS; r < last_row; r++) {
+            int len = rows_ptr[r + 1] - rows_ptr[r];
+            int span = len ? cols[rows_ptr[r + 1] - 1] - cols[rows_ptr[r]] : 0;
+            width = std::max(width, span < 256 ? 1 : (span < 65536 ? 2 : 4));
+        }
+        d.chunk_width[c] = (unsigned char)width;
+        for (int r = c * DELTA_CHUNK_ROWS; r < last_row; r++)
+            d.row_base[r] = (width == 4 || rows_ptr[r + 1] == rows_ptr[r]) ? 0 : cols[rows_ptr[r]];
+    }
+
+    //offsets of the chunks in the array of their width
+    long long sizes[5] = {0, 0, 0, 0, 0};
+    for (int w = 0; w < 5; w++) d.rows_per_width[w] = 0;
+    for (int c = 0; c < n_chunks; c++) {
+        int width = d.chunk_width[c];
+        int first_row = c * DELTA_CHUNK_ROWS, last_row = std::min(rows_number, first_row + DELTA_CHUNK_ROWS);
+        d.chunk_offset[c] = sizes[width];
+        sizes[width] += rows_ptr[last_row] - rows_ptr[first_row];
+        d.rows_per_width[width] += last_row - first_row;
+    }
+    d.idx8.assign(sizes[1], 0);
+    d.idx16.assign(sizes[2], 0);
+    d.idx32.assign(sizes[4], 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < n_chunks; c++) {
+        int first_row = c * DELTA_CHUNK_ROWS, last_row = std::min(rows_number, first_row + DELTA_CHUNK_ROWS);
+        long long out = d.chunk_offset[c] - rows_ptr[first_row];
+        for (int r = first_row; r < last_row; r++) {
+            int base = d.row_base[r];
+            for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+                switch (d.chunk_width[c]) {
+                    case 1: d.idx8[out + idx] = (uint8_t)(cols[idx] - base); break;
+                    case 2: d.idx16[out + idx] = (uint16_t)(cols[idx] - base); break;
+                    default: d.idx32[out + idx] = cols[idx]; break;
+                }
+            }
+        }
+    }
+}
+
+//bytes of the index streams
+static inline long long delta_index_bytes(const DeltaCsr& d) {
+    return (long long)(d.idx8.size() * sizeof(uint8_t) + d.idx16.size() * sizeof(uint16_t) + d.idx32.size() * sizeof(int32_t));
+}
+
+//bytes of the index stream / bytes of the CSR cols array
+static inline double delta_index_ratio(const DeltaCsr& d) {
+    long long csr_bytes = (long long)d.csr->nnz * sizeof(int);
+    return csr_bytes ? (double)delta_index_bytes(d) / csr_bytes : 1.0;
+}
+
+template <typename T>
+static inline double delta_row(const T* idx, const double* values, int len, const double* xb) {
+    double sum = 0.0;
+    for (int k = 0; k < len; k++)
+        sum += values[k] * xb[idx[k]];
+    return sum;
+}
+
+/*y = A*x WITH THE COMPRESSED INDICES*/
+static inline void spmv_delta(const DeltaCsr& d, const double* x, double* y) {
+    const int* rows_ptr = d.csr->rows_ptr;
+    const double* values = d.csr->values;
+    const int* row_base = d.row_base.data();
+    const unsigned char* chunk_width = d.chunk_width.data();
+    const long long* chunk_offset = d.chunk_offset.data();
+    const uint8_t* idx8 = d.idx8.data();
+    const uint16_t* idx16 = d.idx16.data();
+    const int32_t* idx32 = d.idx32.data();
+    int rows_number = d.csr->rows_number;
+
+    #pragma omp parallel for schedule(runtime)
+    for (int r = 0; r < rows_number; r++) {
+        int c = r / DELTA_CHUNK_ROWS;
+        int len = rows_ptr[r + 1] - rows_ptr[r];
+        const double* v = values + rows_ptr[r];
+        const double* xb = x + row_base[r];
+        long long pos = chunk_offset[c] + rows_ptr[r] - rows_ptr[c * DELTA_CHUNK_ROWS];
+
+        switch (chunk_width[c]) {
+            case 1: y[r] = delta_row(idx8 + pos, v, len, xb); break;
+            case 2: y[r] = delta_row(idx16 + pos, v, len, xb); break;
+            default: y[r] = delta_row(idx32 + pos, v, len, xb); break;
+        }
+    }
+}
+
+#endif
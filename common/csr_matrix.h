@@ -0,0 +1,261 @@
+#ifndef CSR_MATRIX_H
+#define CSR_MATRIX_H
+
+/*
+ * CSR MATRIX SHARED BY THE SpMV BINARIES
+ *
+ * The kernels only see the three raw arrays (rows_ptr, cols, values): they either point into the
+ * vectors owned by the struct (matrix built from the .mtx) or directly into a mapped binary cache file
+ * (see csr_cache.h), so that a cached matrix can be used in place without copying it.
+ */
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <sys/mman.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "mtx_parser.h"
+
+struct CSRMatrix {
+    int rows_number;
+    int columns_number;
+    int nnz;            //stored entries (symmetric matrices are already expanded, unless half_storage is set)
+    int is_symmetric;   //symmetry of the source file (MTX_GENERAL, MTX_SYMMETRIC, MTX_SKEW_SYMMETRIC)
+    int half_storage;   //1 if only the lower triangle and the diagonal of a symmetric matrix are stored
+
+    const int* rows_ptr;
+    const int* cols;
+    const double* values;
+
+    //owned storage, empty when the arrays live in a mapped file
+    std::vector<int> rows_ptr_storage;
+    std::vector<int> cols_storage;
+    std::vector<double> values_storage;
+
+    //mapped cache file, or anonymous mapping of the NUMA-placed copy (NULL if the matrix was built in memory)
+    void* map_base;
+    size_t map_size;
+
+    CSRMatrix() : rows_number(0), columns_number(0), nnz(0), is_symmetric(MTX_GENERAL), half_storage(0),
+                  rows_ptr(NULL), cols(NULL), values(NULL), map_base(NULL), map_size(0) {}
+
+    ~CSRMatrix() {
+        if (map_base) munmap(map_base, map_size);
+    }
+
+    //points the raw arrays to the owned vectors
+    void use_storage() {
+        rows_ptr = rows_ptr_storage.data();
+        cols = cols_storage.data();
+        values = values_storage.data();
+    }
+
+private:
+    CSRMatrix(const CSRMatrix&);
+    CSRMatrix& operator=(const CSRMatrix&);
+};
+
+//nonzeros of the whole matrix (with the half storage the mirrored entries are counted too, the diagonal once)
+static inline long long csr_product_nonzeros(const CSRMatrix& csr) {
+    if (!csr.half_storage) return csr.nnz;
+    long long diagonal = 0;
+    for (int row = 0; row < csr.rows_number; row++)
+        if (csr.rows_ptr[row] < csr.rows_ptr[row + 1] && csr.cols[csr.rows_ptr[row + 1] - 1] == row) diagonal++;
+    return 2LL * csr.nnz - diagonal;
+}
+
+/*
+ * EXCLUSIVE PREFIX SUM OF a[0..n) IN PLACE (a[n] RECEIVES THE TOTAL), a MUST HAVE n+1 ELEMENTS.
+ * Two-level parallel scan: every thread sums its block, the block totals are scanned, then each block is scanned with its offset.
+ */
+static inline void parallel_exclusive_scan(int* a, int n) {
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    std::vector<long long> block_sum(max_threads + 1, 0);
+    long long total = 0;
+
+    #pragma omp parallel num_threads(max_threads)
+    {
+        int t = 0, n_threads = 1;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        n_threads = omp_get_num_threads();  //the team could be smaller than requested
+#endif
+        int lo = (int)((long long)n * t / n_threads), hi = (int)((long long)n * (t + 1) / n_threads);
+        long long sum = 0;
+        for (int i = lo; i < hi; i++) sum += a[i];
+        block_sum[t + 1] = sum;
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            for (int b = 0; b < n_threads; b++) block_sum[b + 1] += block_sum[b];
+            total = block_sum[n_threads];
+        }
+
+        long long running = block_sum[t];
+        for (int i = lo; i < hi; i++) {
+            int v = a[i];
+            a[i] = (int)running;
+            running += v;
+        }
+    }
+    a[n] = (int)total;
+}
+
+//sorts the entries of one row by column (insertion sort: rows are short and usually almost sorted)
+static inline void sort_csr_row(int* cols, double* values, int len) {
+    for (int i = 1; i < len; i++) {
+        int c = cols[i];
+        double v = values[i];
+        int j = i - 1;
+        while (j >= 0 && cols[j] > c) {
+            cols[j + 1] = cols[j];
+            values[j + 1] = values[j];
+            j--;
+        }
+        cols[j + 1] = c;
+        values[j + 1] = v;
+    }
+}
+
+//sorts by column only the rows that are not sorted yet (insertion sort for short rows, std::sort otherwise)
+static inline void sort_csr_rows(const int* rows_ptr, int rows_number, int* cols, double* values) {
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int r = 0; r < rows_number; r++) {
+        for (int idx = rows_ptr[r] + 1; idx < rows_ptr[r + 1]; idx++) {
+            if (cols[idx - 1] > cols[idx]) {
+                int len = rows_ptr[r + 1] - rows_ptr[r];
+                if (len <= 64)
+                    sort_csr_row(cols + rows_ptr[r], values + rows_ptr[r], len);
+                else {
+                    std::vector<std::pair<int, double> > row(len);
+                    for (int k = 0; k < len; k++) row[k] = std::make_pair(cols[rows_ptr[r] + k], values[rows_ptr[r] + k]);
+                    std::sort(row.begin(), row.end());
+                    for (int k = 0; k < len; k++) {
+                        cols[rows_ptr[r] + k] = row[k].first;
+                        values[rows_ptr[r] + k] = row[k].second;
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * CREATION OF THE CSR REPRESENTATION FROM THE LIST OF NODES (0-BASED, ALREADY EXPANDED IF SYMMETRIC).
+ *
+ * Parallel counting sort instead of std::sort on the whole vector<Node> (O(nnz) and multithreaded):
+ *   1. every thread builds the row histogram of its contiguous block of nodes, a prefix sum gives rows_ptr
+ *      and the position where each thread starts writing inside each row;
+ *   2. every thread scatters its block into cols/values.
+ * The order of the nodes inside a row is the order of the file (which is already by column for the usual
+ * column-major .mtx files), so each row is sorted only if it is not sorted yet.
+ * The per-thread histograms take T*(rows+1) ints: when that is more than the cols array itself (many threads,
+ * very sparse rows) a single histogram with atomic updates is used instead, and the scatter order inside a row
+ * is fixed by the per-row sort.
+ */
+static inline void build_csr(const std::vector<Node>& matrix, const MtxHeader& h, CSRMatrix& csr) {
+    int rows_number = h.rows_number;
+    long long n_elements = (long long)matrix.size();
+
+    csr.rows_number = rows_number;
+    csr.columns_number = h.columns_number;
+    csr.nnz = (int)n_elements;
+    csr.is_symmetric = h.is_symmetric;
+    csr.half_storage = 0;
+
+    csr.rows_ptr_storage.assign(rows_number + 1, 0);
+    csr.cols_storage.resize(n_elements);
+    csr.values_storage.resize(n_elements);
+
+    int* rows_ptr = csr.rows_ptr_storage.data();
+    int* cols = csr.cols_storage.data();
+    double* values = csr.values_storage.data();
+
+    int n_threads = 1;
+#ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+#endif
+
+    if ((long long)n_threads * (rows_number + 1) <= std::max(n_elements, (long long)rows_number + 1)) {
+        /*PER-THREAD HISTOGRAMS: hist[t * rows_number + r] = NUMBER OF NODES OF ROW r IN THE BLOCK t OF THE NODES*/
+        std::vector<int> hist((size_t)n_threads * rows_number, 0);
+
+        #pragma omp parallel for schedule(static, 1) num_threads(n_threads)
+        for (int t = 0; t < n_threads; t++) {
+            long long lo = n_elements * t / n_threads, hi = n_elements * (t + 1) / n_threads;
+            int* my_hist = hist.data() + (size_t)t * rows_number;
+            for (long long i = lo; i < hi; i++)
+                my_hist[matrix[i].row]++;
+        }
+
+        //count of the values in each row
+        #pragma omp parallel for schedule(static)
+        for (int r = 0; r < rows_number; r++) {
+            int count = 0;
+            for (int t = 0; t < n_threads; t++) count += hist[(size_t)t * rows_number + r];
+            rows_ptr[r] = count;
+        }
+
+        //using the offset in the array
+        parallel_exclusive_scan(rows_ptr, rows_number);
+
+        //each (block, row) pair gets its own starting position inside the row
+        #pragma omp parallel for schedule(static)
+        for (int r = 0; r < rows_number; r++) {
+            int start = rows_ptr[r];
+            for (int t = 0; t < n_threads; t++) {
+                int count = hist[(size_t)t * rows_number + r];
+                hist[(size_t)t * rows_number + r] = start;
+                start += count;
+            }
+        }
+
+        //scatter
+        #pragma omp parallel for schedule(static, 1) num_threads(n_threads)
+        for (int t = 0; t < n_threads; t++) {
+            long long lo = n_elements * t / n_threads, hi = n_elements * (t + 1) / n_threads;
+            int* my_hist = hist.data() + (size_t)t * rows_number;
+            for (long long i = lo; i < hi; i++) {
+                int pos = my_hist[matrix[i].row]++;
+                cols[pos] = matrix[i].col;
+                values[pos] = matrix[i].value;
+            }
+        }
+    }
+    else {
+        /*SHARED HISTOGRAM WITH ATOMIC UPDATES (LESS MEMORY, NON-DETERMINISTIC ORDER INSIDE A ROW)*/
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < n_elements; i++) {
+            #pragma omp atomic
+            rows_ptr[matrix[i].row]++;
+        }
+
+        parallel_exclusive_scan(rows_ptr, rows_number);
+
+        std::vector<int> cursor(rows_ptr, rows_ptr + rows_number);
+
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < n_elements; i++) {
+            int pos;
+            #pragma omp atomic capture
+            pos = cursor[matrix[i].row]++;
+            cols[pos] = matrix[i].col;
+            values[pos] = matrix[i].value;
+        }
+    }
+
+    /*FIXES THE COLUMN ORDER ONLY IN THE ROWS THAT NEED IT*/
+    sort_csr_rows(rows_ptr, rows_number, cols, values);
+
+    csr.use_storage();
+}
+
+#endif
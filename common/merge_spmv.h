@@ -0,0 +1,95 @@
+#ifndef MERGE_SPMV_H
+#define MERGE_SPMV_H
+
+/*
+ * MERGE-PATH CSR SpMV (Merrill & Garland, "Merge-based parallel sparse matrix-vector multiplication")
+ *
+ * "#pragma omp parallel for" over the rows gives every thread the same number of ROWS, so with uneven rows the
+ * best scheduling clause depends on the matrix. Here the work is the merge of two lists: the row ends
+ * (rows_ptr[1..rows]) and the nonzeros (0..nnz-1). The merge path has rows + nnz steps and every thread takes an
+ * equal slice of it, found with a binary search over rows_ptr, so every thread gets the same rows + nonzeros
+ * no matter how they are distributed.
+ *
+ * A row can be split between two (or more) threads: the thread that reaches the end of the row writes y[row],
+ * the threads that only computed its first part leave their partial sum in a carry-out, which is added after
+ * the parallel region (one value per thread).
+ */
+
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+
+/*
+ * COORDINATES OF THE POINT OF THE MERGE PATH ON THE GIVEN DIAGONAL: row_idx row ends and nz_idx nonzeros have
+ * been consumed before it (row_idx + nz_idx = diagonal).
+ */
+static inline void merge_path_search(long long diagonal, const int* row_end, int rows_number, int nnz,
+                                     int& row_idx, int& nz_idx) {
+    long long lo = std::max(diagonal - nnz, 0LL);
+    long long hi = std::min(diagonal, (long long)rows_number);
+
+    while (lo < hi) {
+        long long pivot = (lo + hi) / 2;
+        if (row_end[pivot] <= diagonal - pivot - 1)
+            lo = pivot + 1;
+        else
+            hi = pivot;
+    }
+    row_idx = (int)lo;
+    nz_idx = (int)(diagonal - lo);
+}
+
+/*y = A*x WITH AN EQUAL SHARE OF THE MERGE PATH (ROWS + NONZEROS) PER THREAD*/
+static inline void spmv_merge(const CSRMatrix& csr, const double* x, double* y) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* row_end = csr.rows_ptr + 1;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    int rows_number = csr.rows_number;
+    int nnz = rows_ptr[rows_number];
+
+    int n_threads = 1;
+#ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+#endif
+    long long path_length = (long long)rows_number + nnz;
+    long long items_per_thread = (path_length + n_threads - 1) / n_threads;
+
+    std::vector<int> carry_row(n_threads);
+    std::vector<double> carry_value(n_threads);
+
+    #pragma omp parallel for schedule(static, 1) num_threads(n_threads)
+    for (int t = 0; t < n_threads; t++) {
+        long long diagonal_start = std::min(items_per_thread * t, path_length);
+        long long diagonal_end = std::min(diagonal_start + items_per_thread, path_length);
+
+        int row, nz, row_stop, nz_stop;
+        merge_path_search(diagonal_start, row_end, rows_number, nnz, row, nz);
+        merge_path_search(diagonal_end, row_end, rows_number, nnz, row_stop, nz_stop);
+
+        //rows that end inside the slice
+        for (; row < row_stop; row++) {
+            double sum = 0.0;
+            for (; nz < row_end[row]; nz++)
+                sum += values[nz] * x[cols[nz]];
+            y[row] = sum;
+        }
+
+        //first part of the row that continues in the next slice
+        double sum = 0.0;
+        for (; nz < nz_stop; nz++)
+            sum += values[nz] * x[cols[nz]];
+        carry_row[t] = row_stop;
+        carry_value[t] = sum;
+    }
+
+    /*FIX-UP OF THE ROWS SPLIT BETWEEN THREADS*/
+    for (int t = 0; t < n_threads; t++)
+        if (carry_row[t] < rows_number)
+            y[carry_row[t]] += carry_value[t];
+}
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef MTX_PARSER_H
+#define MTX_PARSER_H
+
+/*
+ * PARALLEL MATRIX MARKET PARSER
+ *
+ * The .mtx file is mapped in memory (mmap) instead of being read line by line with fgets + sscanf.
+ * The body of the file is split into newline-aligned chunks, one per thread, and every chunk is parsed
+ * with a hand-written integer/float scanner (no locale, no sscanf).
+ * Each thread first counts the entries of its chunk, so that after a prefix sum it knows where to write
+ * and can fill the vector<Node> directly, without temporary buffers.
+ *
+ * Without -fopenmp (sequential.cpp) everything simply runs on a single chunk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+struct Node {
+    int row, col;
+    double value;
+
+    //empty constructor: resizing a vector<Node> must not zero-fill (serially) memory that the parser overwrites anyway
+    Node() {}
+    Node(int r, int c, double v) : row(r), col(c), value(v) {}
+};
+
+#define MTX_GENERAL 0
+#define MTX_SYMMETRIC 1
+#define MTX_SKEW_SYMMETRIC 2
+
+struct MtxHeader {
+    int rows_number;
+    int columns_number;
+    int nnz;            //number of entries written in the file (NOT expanded)
+    int is_symmetric;   //MTX_GENERAL, MTX_SYMMETRIC or MTX_SKEW_SYMMETRIC
+    int is_pattern;     //entries have no value (it is set to 1.0)
+};
+
+struct MtxFile {
+    const char* data;
+    size_t size;
+    int fd;
+};
+
+/*MAPS THE WHOLE FILE IN MEMORY (READ ONLY)*/
+static inline int mtx_open(const char* filename, MtxFile& f) {
+    f.data = NULL;
+    f.size = 0;
+    f.fd = open(filename, O_RDONLY);
+    if (f.fd < 0) {
+        fprintf(stderr, "[ERR] Error while opening the file\n");
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(f.fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "[ERR] Empty file or error while reading\n");
+        close(f.fd);
+        return 1;
+    }
+    f.size = (size_t)st.st_size;
+
+    void* map = mmap(NULL, f.size, PROT_READ, MAP_PRIVATE, f.fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "[ERR] Error while mapping the file in memory\n");
+        close(f.fd);
+        return 1;
+    }
+    //the file is read front to back by every thread: ask the kernel for an aggressive read-ahead
+    madvise(map, f.size, MADV_SEQUENTIAL);
+    madvise(map, f.size, MADV_WILLNEED);
+
+    f.data = (const char*)map;
+    return 0;
+}
+
+static inline void mtx_close(MtxFile& f) {
+    if (f.data) munmap((void*)f.data, f.size);
+    if (f.fd >= 0) close(f.fd);
+    f.data = NULL;
+    f.fd = -1;
+}
+
+/*SCANNER: SMALL HELPERS WORKING ON [p, end) WITHOUT ANY NULL TERMINATOR*/
+
+static inline const char* mtx_skip_blanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static inline const char* mtx_next_line(const char* p, const char* end) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+static inline const char* mtx_scan_int(const char* p, const char* end, int& out) {
+    p = mtx_skip_blanks(p, end);
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    if (p == end || (unsigned)(*p - '0') > 9) return NULL;
+
+    long long v = 0;
+    while (p < end && (unsigned)(*p - '0') <= 9) {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    out = (int)(neg ? -v : v);
+    return p;
+}
+
+//10^e computed in extended precision (used only when the exact fast path of mtx_scan_double can't be taken)
+static inline long double mtx_pow10l(int e) {
+    long double result = 1.0L, base = 10.0L;
+    while (e > 0) {
+        if (e & 1) result *= base;
+        base *= base;
+        e >>= 1;
+    }
+    return result;
+}
+
+/*
+ * Float scanner. Up to 19 significant digits are accumulated in an integer mantissa.
+ * When the mantissa has at most 15 digits and |exponent| <= 22 both operands are exact doubles,
+ * so a single multiplication/division gives the correctly rounded value (same as strtod).
+ * Otherwise the scaling is done in long double, which may differ from strtod in the last bit.
+ */
+static inline const char* mtx_scan_double(const char* p, const char* end, double& out) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    p = mtx_skip_blanks(p, end);
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0;
+    bool any_digit = false;
+
+    while (p < end && (unsigned)(*p - '0') <= 9) {
+        any_digit = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        }
+        else exp10++;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && (unsigned)(*p - '0') <= 9) {
+            any_digit = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+                exp10--;
+            }
+            p++;
+        }
+    }
+    if (!any_digit) return NULL;
+
+    //exponent (also the Fortran 'd' notation that some generators still write)
+    if (p < end && (*p == 'e' || *p == 'E' || *p == 'd' || *p == 'D')) {
+        const char* q = p + 1;
+        bool exp_neg = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            exp_neg = (*q == '-');
+            q++;
+        }
+        if (q < end && (unsigned)(*q - '0') <= 9) {
+            int e = 0;
+            while (q < end && (unsigned)(*q - '0') <= 9) {
+                if (e < 10000) e = e * 10 + (*q - '0');
+                q++;
+            }
+            exp10 += exp_neg ? -e : e;
+            p = q;
+        }
+    }
+
+    double v;
+    if (mantissa == 0)
+        v = 0.0;
+    else if (digits <= 15 && exp10 >= -22 && exp10 <= 22)
+        v = exp10 < 0 ? (double)mantissa / pow10[-exp10] : (double)mantissa * pow10[exp10];
+    else if (exp10 < -400)
+        v = 0.0;
+    else if (exp10 > 400)
+        v = HUGE_VAL;
+    else
+        v = (double)(exp10 < 0 ? (long double)mantissa / mtx_pow10l(-exp10) : (long double)mantissa * mtx_pow10l(exp10));
+
+    out = neg ? -v : v;
+    return p;
+}
+
+/*
+ * PARSES ONE LINE OF THE BODY STARTING AT p AND MOVES p TO THE BEGINNING OF THE NEXT LINE.
+ * Returns 1 if an entry was read (indices are converted to 0-based), 0 for blank/comment lines, -1 if the line is malformed.
+ */
+static inline int mtx_parse_entry(const char*& p, const char* end, Node& node, int is_pattern) {
+    const char* q = mtx_skip_blanks(p, end);
+    if (q == end || *q == '\n' || *q == '%') {
+        p = mtx_next_line(q, end);
+        return 0;
+    }
+
+    int r, c;
+    double v = 1.0;
+    q = mtx_scan_int(q, end, r);
+    if (q) q = mtx_scan_int(q, end, c);
+    if (q && !is_pattern) q = mtx_scan_double(q, end, v);
+    if (!q) {
+        p = mtx_next_line(p, end);
+        return -1;
+    }
+
+    node.row = r - 1;
+    node.col = c - 1;
+    node.value = v;
+    p = mtx_next_line(q, end);
+    return 1;
+}
+
+//counts the entry lines in [p, end) (same rule used by mtx_parse_entry to skip blank and comment lines)
+static inline long long mtx_count_entries(const char* p, const char* end) {
+    long long count = 0;
+    while (p < end) {
+        const char* q = mtx_skip_blanks(p, end);
+        if (q < end && *q != '\n' && *q != '%') count++;
+        p = mtx_next_line(q, end);
+    }
+    return count;
+}
+
+/*
+ * READS THE BANNER, SKIPS THE COMMENTS AND READS THE SIZE LINE (#ROWS, #COLUMNS, #NON ZERO VALUES).
+ * body_offset is set to the first byte after the size line. Works on any prefix of the file that contains the size line.
+ */
+static inline int mtx_parse_header(const char* data, size_t size, MtxHeader& h, size_t& body_offset) {
+    const char* p = data;
+    const char* end = data + size;
+
+    //CATCH IF THE MATRIX IS SYMMETRIC (ONLY FIRST LINE)
+    const char* banner_end = mtx_next_line(p, end);
+    h.is_symmetric = MTX_GENERAL;
+    h.is_pattern = 0;
+    for (const char* s = p; s < banner_end; s++) {
+        size_t left = banner_end - s;
+        if (left >= 14 && strncmp(s, "skew-symmetric", 14) == 0) {
+            h.is_symmetric = MTX_SKEW_SYMMETRIC;
+            break;
+        }
+        if (left >= 9 && strncmp(s, "symmetric", 9) == 0) h.is_symmetric = MTX_SYMMETRIC;
+        if (left >= 7 && strncmp(s, "pattern", 7) == 0) h.is_pattern = 1;
+    }
+    p = banner_end;
+
+    //skips the comments (a line of blanks may run up to the end of the buffer: q is checked before it is read)
+    while (p < end) {
+        const char* q = mtx_skip_blanks(p, end);
+        if (q >= end || *q != '%') break;
+        p = mtx_next_line(q, end);
+    }
+    if (p >= end) {
+        fprintf(stderr, "[ERR] Empty file or error while reading\n");
+        return 1;
+    }
+
+    const char* q = mtx_scan_int(p, end, h.rows_number);
+    if (q) q = mtx_scan_int(q, end, h.columns_number);
+    if (q) q = mtx_scan_int(q, end, h.nnz);
+    if (!q || h.rows_number <= 0 || h.columns_number <= 0 || h.nnz < 0) {
+        fprintf(stderr, "[ERR] Malformed size line in the Matrix Market header\n");
+        return 1;
+    }
+
+    body_offset = mtx_next_line(q, data + size) - data;
+    return 0;
+}
+
+//returns 1 if [data, data+size) contains the whole header (banner, comments and the size line with its newline)
+static inline int mtx_header_complete(const char* data, size_t size) {
+    const char* end = data + size;
+    const char* p = mtx_next_line(data, end);
+    while (p < end) {
+        const char* q = mtx_skip_blanks(p, end);
+        if (q >= end || *q != '%') break;
+        p = mtx_next_line(q, end);
+    }
+    return p < end && memchr(p, '\n', end - p) != NULL;
+}
+
+/*
+ * LOADS THE WHOLE MATRIX INTO matrix (0-BASED COORDINATES).
+ * If expand_symmetric is set, every off-diagonal entry of a symmetric matrix is mirrored, as the original fgets loops did.
+ * Unlike them, the mirror of a skew-symmetric entry is negated (they copied it unchanged, which gave A + A^T instead of A).
+ * The mirrored entries are appended after the nnz entries of the file.
+ */
+static inline int mtx_load(const char* filename, MtxHeader& h, std::vector<Node>& matrix, int expand_symmetric) {
+    MtxFile f;
+    if (mtx_open(filename, f) != 0) return 1;
+
+    size_t body_offset;
+    if (mtx_parse_header(f.data, f.size, h, body_offset) != 0) {
+        mtx_close(f);
+        return 1;
+    }
+
+    const char* body = f.data + body_offset;
+    const char* end = f.data + f.size;
+    int expand = expand_symmetric && h.is_symmetric != MTX_GENERAL;
+
+    /*SPLITS THE BODY INTO NEWLINE-ALIGNED CHUNKS (ONE PER THREAD)*/
+    int n_chunks = 1;
+#ifdef _OPENMP
+    n_chunks = omp_get_max_threads();
+#endif
+    //very small files are not worth splitting
+    if ((size_t)(end - body) < (size_t)n_chunks * 4096) n_chunks = 1;
+
+    std::vector<const char*> bounds(n_chunks + 1);
+    bounds[0] = body;
+    bounds[n_chunks] = end;
+    for (int t = 1; t < n_chunks; t++) {
+        const char* b = body + (size_t)(end - body) * t / n_chunks;
+        if (b < bounds[t - 1]) b = bounds[t - 1];
+        //a chunk starts right after a newline: the line containing b belongs to the previous chunk
+        bounds[t] = (b > body && b[-1] != '\n') ? mtx_next_line(b, end) : b;
+    }
+
+    /*FIRST PASS: EACH THREAD COUNTS ITS ENTRIES, THEN A PREFIX SUM GIVES THE WRITE OFFSET OF EVERY CHUNK*/
+    std::vector<long long> offsets(n_chunks + 1, 0);
+    #pragma omp parallel for schedule(static, 1) num_threads(n_chunks)
+    for (int t = 0; t < n_chunks; t++)
+        offsets[t + 1] = mtx_count_entries(bounds[t], bounds[t + 1]);
+
+    for (int t = 0; t < n_chunks; t++)
+        offsets[t + 1] += offsets[t];
+
+    if (offsets[n_chunks] < h.nnz) {
+        fprintf(stderr, "[ERR] Something went wrong while reading the file (unexpected EOF at line %lld)\n", offsets[n_chunks]);
+        mtx_close(f);
+        return 1;
+    }
+    //entry lines after the nnz-th one are rejected, as in the MPI loader (the header and the body disagree)
+    if (offsets[n_chunks] > h.nnz) {
+        fprintf(stderr, "[ERR] Something went wrong while reading the file (%lld entries, %d declared in the header)\n", offsets[n_chunks], h.nnz);
+        mtx_close(f);
+        return 1;
+    }
+
+    /*SECOND PASS: EVERY THREAD PARSES ITS CHUNK DIRECTLY INTO THE FINAL VECTOR*/
+    //since I alredy know the actual size of the vector, I reserve some memory to speed up the allocation.
+    matrix.clear();
+    matrix.reserve(expand ? 2 * (size_t)h.nnz : (size_t)h.nnz);
+    matrix.resize(h.nnz);
+
+    int malformed = 0;
+    #pragma omp parallel for schedule(static, 1) num_threads(n_chunks) reduction(+:malformed)
+    for (int t = 0; t < n_chunks; t++) {
+        const char* p = bounds[t];
+        long long i = offsets[t];
+        while (p < bounds[t + 1] && i < h.nnz) {
+            int ret = mtx_parse_entry(p, bounds[t + 1], matrix[i], h.is_pattern);
+            if (ret == 1) {
+                Node& n = matrix[i];
+                if (n.row < 0 || n.row >= h.rows_number || n.col < 0 || n.col >= h.columns_number) malformed++;
+                i++;
+            }
+            else if (ret < 0) malformed++;
+        }
+    }
+
+    mtx_close(f);
+
+    if (malformed) {
+        fprintf(stderr, "[ERR] %d malformed (or out of range) entries in %s\n", malformed, filename);
+        return 1;
+    }
+
+    /*SYMMETRIC EXPANSION: COUNT THE OFF-DIAGONAL ENTRIES OF EACH BLOCK, PREFIX SUM, THEN WRITE THE MIRRORED ENTRIES*/
+    if (expand) {
+        std::vector<long long> mirror_offsets(n_chunks + 1, 0);
+        double sign = (h.is_symmetric == MTX_SKEW_SYMMETRIC) ? -1.0 : 1.0;
+        long long base = h.nnz;
+
+        #pragma omp parallel for schedule(static, 1) num_threads(n_chunks)
+        for (int t = 0; t < n_chunks; t++) {
+            long long lo = (long long)h.nnz * t / n_chunks, hi = (long long)h.nnz * (t + 1) / n_chunks;
+            long long count = 0;
+            for (long long i = lo; i < hi; i++)
+                if (matrix[i].row != matrix[i].col) count++;
+            mirror_offsets[t + 1] = count;
+        }
+        for (int t = 0; t < n_chunks; t++)
+            mirror_offsets[t + 1] += mirror_offsets[t];
+
+        matrix.resize(base + mirror_offsets[n_chunks]);
+
+        #pragma omp parallel for schedule(static, 1) num_threads(n_chunks)
+        for (int t = 0; t < n_chunks; t++) {
+            long long lo = (long long)h.nnz * t / n_chunks, hi = (long long)h.nnz * (t + 1) / n_chunks;
+            long long out = base + mirror_offsets[t];
+            for (long long i = lo; i < hi; i++) {
+                const Node& n = matrix[i];
+                if (n.row != n.col) matrix[out++] = Node(n.col, n.row, sign * n.value);
+            }
+        }
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+
+/*
+ * NUMA PLACEMENT OF THE CSR ARRAYS AND OF THE VECTORS (--placement=...)
+ *
+ * Linux places a page on the node of the thread that first writes it. The binaries fill rows_ptr, cols, values,
+ * x and y from the main thread (or map them from the binary cache), so on a two-socket node every page is on one
+ * socket and half of the threads read remote memory. With --placement=first-touch:
+ *   - the CSR arrays are copied into a new anonymous mapping (pages not touched yet) by all the threads, every
+ *     thread writing the rows it will compute, and the original arrays (or the mapped cache) are released;
+ *   - x and y are allocated without initialization (PlacedVector) and zeroed by the same threads, before x is filled.
+ * The rows of a thread are the ones of the partition used by the kernel: the static blocks of the runtime
+ * schedule (schedule(static) without chunk), the nnz-balanced blocks of row_partition.h (balanced, sym, tiled) or the
+ * merge path slices (merge). With dynamic/guided schedules no thread owns the rows, the nnz-balanced blocks are used.
+ * --placement=interleave does the same, but the pages of x (read at random columns by every thread) are spread
+ * round-robin over all the nodes (mbind MPOL_INTERLEAVE) instead of following the rows.
+ * The formats built by prepare_kernel (sell, bcsr, delta) are written by parallel loops, so they follow their own
+ * first touch.
+ *
+ * The threads must be pinned (e.g. OMP_PROC_BIND=close OMP_PLACES=cores), otherwise a thread may not run on the
+ * node where its pages were placed. When --placement is given, the node of the pages of every array is printed
+ * on stderr (move_pages on a sample of the pages). mbind and move_pages are called with syscall(), so no libnuma is needed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+#include "row_partition.h"
+#include "merge_spmv.h"
+#include "spmv_options.h"
+
+#define NUMA_MPOL_INTERLEAVE 3          //<numaif.h>
+#define NUMA_MAX_NODES 64
+#define NUMA_REPORT_PAGES 65536         //pages queried per array at most
+
+/*
+ * ALLOCATOR THAT DOES NOT INITIALIZE THE ELEMENTS (vector(n) leaves them untouched) AND TAKES THE MEMORY FROM
+ * mmap, SO THE PAGES ARE NOT TOUCHED UNTIL THE FIRST WRITE AND ARE PAGE-ALIGNED (NEEDED BY mbind).
+ */
+template <typename T>
+struct FirstTouchAllocator {
+    typedef T value_type;
+
+    FirstTouchAllocator() {}
+    template <typename U> FirstTouchAllocator(const FirstTouchAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n == 0) return NULL;
+        void* p = mmap(NULL, n * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+        return (T*)p;
+    }
+    void deallocate(T* p, size_t n) {
+        if (p) munmap(p, n * sizeof(T));
+    }
+
+    template <typename U> void construct(U* p) { ::new((void*)p) U; }     //default-initialization: no write
+    template <typename U, typename... Args> void construct(U* p, Args&&... args) { ::new((void*)p) U(std::forward<Args>(args)...); }
+};
+
+template <typename T, typename U>
+bool operator==(const FirstTouchAllocator<T>&, const FirstTouchAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const FirstTouchAllocator<T>&, const FirstTouchAllocator<U>&) { return false; }
+
+typedef std::vector<double, FirstTouchAllocator<double> > PlacedVector;
+
+struct NumaPlacement {
+    int policy;                 //PLACEMENT_*
+    int report;                 //1 if --placement was given
+    RowPartition partition;     //rows of every thread
+};
+
+//number of NUMA nodes (/sys/devices/system/node/online, e.g. "0-1"), 1 if unknown
+static inline int numa_nodes() {
+    FILE* f = fopen("/sys/devices/system/node/online", "r");
+    if (!f) return 1;
+    int first = 0, last = 0, nodes = 1;
+    int n = fscanf(f, "%d-%d", &first, &last);
+    if (n == 2) nodes = last + 1;
+    else if (n == 1) nodes = first + 1;
+    fclose(f);
+    return std::min(std::max(nodes, 1), NUMA_MAX_NODES);
+}
+
+//blocks of the rows of every thread in the kernel selected by opts (see the comment at the top)
+static inline void placement_partition(const SpmvOptions& opts, const CSRMatrix& csr, RowPartition& p) {
+    int n_threads = 1;
+#ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+    omp_sched_t kind;
+    int chunk;
+    omp_get_schedule(&kind, &chunk);
+#endif
+    int rows_number = csr.rows_number;
+
+    if (opts.kernel == KERNEL_MERGE) {
+        long long path_length = (long long)rows_number + csr.nnz;
+        long long items_per_thread = (path_length + n_threads - 1) / n_threads;
+        p.n_threads = n_threads;
+        p.row_start.resize(n_threads + 1);
+        for (int t = 0; t < n_threads; t++) {
+            int nz;
+            merge_path_search(std::min(items_per_thread * t, path_length), csr.rows_ptr + 1, rows_number, csr.nnz,
+                              p.row_start[t], nz);
+        }
+        p.row_start[n_threads] = rows_number;
+        return;
+    }
+#ifdef _OPENMP
+    //schedule(static) without chunk: rows/T rows per thread, the first rows%T threads get one more (as libgomp)
+    if (opts.kernel != KERNEL_BALANCED && opts.kernel != KERNEL_SYM && opts.kernel != KERNEL_TILED && (kind & ~omp_sched_monotonic) == omp_sched_static && chunk <= 0) {
+        p.n_threads = n_threads;
+        p.row_start.resize(n_threads + 1);
+        int q = rows_number / n_threads, extra = rows_number % n_threads;
+        for (int t = 0; t <= n_threads; t++)
+            p.row_start[t] = q * t + std::min(t, extra);
+        return;
+    }
+#endif
+    build_row_partition(csr, p);
+}
+
+/*
+ * COPY OF THE CSR ARRAYS INTO PAGES FIRST TOUCHED BY THE THREAD THAT OWNS THEIR ROWS. Does nothing (except the
+ * partition) with --placement=none.
+ */
+static inline int numa_place_csr(const SpmvOptions& opts, CSRMatrix& csr, NumaPlacement& pl) {
+    pl.policy = opts.placement < 0 ? PLACEMENT_NONE : opts.placement;
+    pl.report = opts.placement >= 0;
+    placement_partition(opts, csr, pl.partition);
+    if (pl.policy == PLACEMENT_NONE) return 0;
+
+    int rows_number = csr.rows_number;
+    size_t rows_bytes = ((size_t)(rows_number + 1) * sizeof(int) + 4095) & ~(size_t)4095;
+    size_t cols_bytes = ((size_t)csr.nnz * sizeof(int) + 4095) & ~(size_t)4095;
+    size_t size = rows_bytes + cols_bytes + (size_t)csr.nnz * sizeof(double) + 4096;
+    char* base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "[ERR] Could not allocate %zu bytes for the placed CSR arrays\n", size);
+        return 1;
+    }
+    int* rows_ptr = (int*)base;
+    int* cols = (int*)(base + rows_bytes);
+    double* values = (double*)(base + rows_bytes + cols_bytes);
+
+    const RowPartition& p = pl.partition;
+    const int* src_rows_ptr = csr.rows_ptr;
+    #pragma omp parallel for schedule(static, 1) num_threads(p.n_threads)
+    for (int t = 0; t < p.n_threads; t++) {
+        int lo = p.row_start[t], hi = p.row_start[t + 1];
+        int last = hi + (t == p.n_threads - 1);     //the last thread also writes rows_ptr[rows_number]
+        for (int r = lo; r < last; r++) rows_ptr[r] = src_rows_ptr[r];
+        int from = src_rows_ptr[lo], to = src_rows_ptr[hi];
+        memcpy(cols + from, csr.cols + from, (size_t)(to - from) * sizeof(int));
+        memcpy(values + from, csr.values + from, (size_t)(to - from) * sizeof(double));
+    }
+
+    //the placed copy replaces the owned vectors or the mapped cache (released by the destructor from now on)
+    std::vector<int>().swap(csr.rows_ptr_storage);
+    std::vector<int>().swap(csr.cols_storage);
+    std::vector<double>().swap(csr.values_storage);
+    if (csr.map_base) munmap(csr.map_base, csr.map_size);
+    csr.map_base = base;
+    csr.map_size = size;
+    csr.rows_ptr = rows_ptr;
+    csr.cols = cols;
+    csr.values = values;
+    return 0;
+}
+
+/*
+ * FIRST TOUCH OF A VECTOR OF rows_number BLOCKS OF k VALUES (allocated as PlacedVector): every thread zeroes (or
+ * copies from src) the blocks of its rows; is_x selects the interleaved policy for x. With --placement=none the
+ * vector is written by the calling thread, as a std::vector would be.
+ */
+static inline void numa_place_vector(const NumaPlacement& pl, double* v, int rows_number, int k, int is_x, const double* src = NULL) {
+    size_t n = (size_t)rows_number * k;
+    if (pl.policy == PLACEMENT_NONE) {
+        for (size_t i = 0; i < n; i++) v[i] = src ? src[i] : 0.0;
+        return;
+    }
+    if (is_x && pl.policy == PLACEMENT_INTERLEAVE && n > 0) {
+        unsigned long mask = 0;
+        for (int node = 0; node < numa_nodes(); node++) mask |= 1UL << node;
+        if (syscall(SYS_mbind, v, n * sizeof(double), NUMA_MPOL_INTERLEAVE, &mask, (unsigned long)NUMA_MAX_NODES + 1, 0) != 0)
+            fprintf(stderr, "[ERR] mbind(MPOL_INTERLEAVE) failed: %s\n", strerror(errno));
+    }
+
+    const RowPartition& p = pl.partition;
+    #pragma omp parallel for schedule(static, 1) num_threads(p.n_threads)
+    for (int t = 0; t < p.n_threads; t++) {
+        size_t from = (size_t)p.row_start[t] * k, to = (size_t)p.row_start[t + 1] * k;
+        for (size_t i = from; i < to; i++) v[i] = src ? src[i] : 0.0;
+    }
+}
+
+//pages of [data, data+bytes) per node, on a sample of at most NUMA_REPORT_PAGES pages
+static inline void numa_report_array(const char* name, const void* data, size_t bytes) {
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)data & ~(uintptr_t)(page - 1);
+    size_t pages = bytes ? ((uintptr_t)data + bytes - first + page - 1) / page : 0;
+    size_t stride = std::max<size_t>(1, (pages + NUMA_REPORT_PAGES - 1) / NUMA_REPORT_PAGES);
+
+    std::vector<void*> addr;
+    for (size_t i = 0; i < pages; i += stride) addr.push_back((void*)(first + i * page));
+    std::vector<int> status(addr.size(), -1);
+    if (!addr.empty() && syscall(SYS_move_pages, 0, (unsigned long)addr.size(), addr.data(), NULL, status.data(), 0) != 0) {
+        fprintf(stderr, "[NUMA] %-8s move_pages failed: %s\n", name, strerror(errno));
+        return;
+    }
+
+    long long count[NUMA_MAX_NODES] = {0};
+    long long other = 0;
+    for (size_t i = 0; i < status.size(); i++) {
+        if (status[i] >= 0 && status[i] < NUMA_MAX_NODES) count[status[i]]++;
+        else other++;       //not present (never touched) or not queryable
+    }
+    fprintf(stderr, "[NUMA] %-8s %zu pages (%zu sampled):", name, pages, status.size());
+    for (int node = 0; node < numa_nodes(); node++)
+        fprintf(stderr, " node%d %.1f%%", node, status.empty() ? 0.0 : 100.0 * count[node] / status.size());
+    if (other) fprintf(stderr, " unknown %.1f%%", 100.0 * other / status.size());
+    fprintf(stderr, "\n");
+}
+
+static inline void numa_report(const NumaPlacement& pl, const CSRMatrix& csr, const double* x, const double* y, size_t n) {
+    if (!pl.report) return;
+    fprintf(stderr, "[NUMA] placement=%s nodes=%d threads=%d\n", placement_names[pl.policy], numa_nodes(), pl.partition.n_threads);
+#ifdef _OPENMP
+    if (pl.policy != PLACEMENT_NONE && omp_get_proc_bind() == omp_proc_bind_false)
+        fprintf(stderr, "[NUMA] threads are not pinned (set OMP_PROC_BIND and OMP_PLACES), first touch may not match the kernel\n");
+#endif
+    numa_report_array("rows_ptr", csr.rows_ptr, (size_t)(csr.rows_number + 1) * sizeof(int));
+    numa_report_array("cols", csr.cols, (size_t)csr.nnz * sizeof(int));
+    numa_report_array("values", csr.values, (size_t)csr.nnz * sizeof(double));
+    numa_report_array("x", x, n * sizeof(double));
+    numa_report_array("y", y, n * sizeof(double));
+}
+
+#endif
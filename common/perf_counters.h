@@ -0,0 +1,239 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+/*
+ * HARDWARE COUNTERS OF THE TIMED REGION ONLY (--perf-counters)
+ *
+ * The PBS scripts run the whole executable under "perf stat", so the counters also contain the parsing of the .mtx,
+ * the sort of the rows and the creation of the formats, which on most matrices take longer than the product.
+ * Here every OpenMP thread opens with perf_event_open the same events of the scripts as one group (cycles is the
+ * leader, so all of them are scheduled together and their ratios are consistent), attached to the thread itself
+ * (pid 0, any cpu, user space only). The groups are created disabled and are enabled only around the timed products
+ * (perf_counters_start/stop, called by one thread with ioctl on the leaders), so what is counted is the kernel and
+ * the barriers of its parallel region.
+ * The groups follow the OS threads: they are opened in a parallel region with the team of the timed products, and the
+ * OpenMP runtime keeps the same threads for the next regions with the same number of threads.
+ * If the group had to share the counters with other events (multiplexing) the counts are scaled by
+ * time enabled / time running and the report says so. Events that cannot be opened (e.g. no LLC events in a virtual
+ * machine) are reported as n/a; if the leader cannot be opened (perf_event_paranoid, containers) the option only
+ * prints a warning and the run goes on without counters.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <vector>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//the events of "perf stat -e cycles,instructions,L1-dcache-loads,L1-dcache-load-misses,LLC-loads,LLC-load-misses"
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1_LOADS 2
+#define PERF_L1_MISSES 3
+#define PERF_LLC_LOADS 4
+#define PERF_LLC_MISSES 5
+#define PERF_N_EVENTS 6
+
+static const char* const perf_event_names[PERF_N_EVENTS] = {"cycles", "instructions", "L1-dcache-loads",
+                                                            "L1-dcache-load-misses", "LLC-loads", "LLC-load-misses"};
+
+struct PerfCounters {
+    int n_threads;                      //threads with an open group (0 = no counters)
+    std::vector<int> fds;               //n_threads * PERF_N_EVENTS, -1 if the event is not available
+    std::vector<int> slot;              //position of every event in the group read (-1 if not available)
+    std::vector<double> counts;         //counts of the enabled intervals, scaled if multiplexed
+    int multiplexed;                    //1 if some interval was not counted for its whole length
+    int intervals;                      //start/stop pairs
+
+    PerfCounters() : n_threads(0), multiplexed(0), intervals(0) {}
+};
+
+#ifdef __linux__
+static inline int perf_event_open_thread(int event, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    if (event == PERF_CYCLES || event == PERF_INSTRUCTIONS) {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = event == PERF_CYCLES ? PERF_COUNT_HW_CPU_CYCLES : PERF_COUNT_HW_INSTRUCTIONS;
+    }
+    else {
+        attr.type = PERF_TYPE_HW_CACHE;
+        unsigned long long cache = event <= PERF_L1_MISSES ? PERF_COUNT_HW_CACHE_L1D : PERF_COUNT_HW_CACHE_LL;
+        unsigned long long result = (event == PERF_L1_LOADS || event == PERF_LLC_LOADS) ? PERF_COUNT_HW_CACHE_RESULT_ACCESS
+                                                                                         : PERF_COUNT_HW_CACHE_RESULT_MISS;
+        attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    }
+    attr.disabled = group_fd < 0;       //the members follow the leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+/*ONE GROUP PER THREAD OF THE CURRENT TEAM SIZE, 0 IF THE COUNTERS ARE AVAILABLE (OTHERWISE A WARNING AND p STAYS EMPTY)*/
+static inline int perf_counters_open(PerfCounters& p) {
+#ifdef _OPENMP
+    int T = omp_get_max_threads();
+#else
+    int T = 1;
+#endif
+    p.n_threads = 0;
+    p.fds.assign((size_t)T * PERF_N_EVENTS, -1);
+    p.slot.assign(PERF_N_EVENTS, -1);
+    p.counts.assign((size_t)T * PERF_N_EVENTS, 0.0);
+    p.multiplexed = 0;
+    p.intervals = 0;
+#ifdef __linux__
+    std::vector<int> opened(PERF_N_EVENTS, 1);
+    int error = 0, failed = 0;
+
+    #pragma omp parallel num_threads(T)
+    {
+#ifdef _OPENMP
+        int tid = omp_get_thread_num();
+#else
+        int tid = 0;
+#endif
+        int* fds = &p.fds[(size_t)tid * PERF_N_EVENTS];
+        fds[0] = perf_event_open_thread(PERF_CYCLES, -1);
+        if (fds[0] < 0) {
+            #pragma omp critical(perf_open)
+            {
+                failed = 1;
+                error = errno;
+            }
+        }
+        else
+            for (int e = 1; e < PERF_N_EVENTS; e++) fds[e] = perf_event_open_thread(e, fds[0]);
+
+        //an event is reported only if every thread could open it
+        #pragma omp critical(perf_open)
+        for (int e = 0; e < PERF_N_EVENTS; e++)
+            if (fds[e] < 0) opened[e] = 0;
+    }
+
+    if (failed) {
+        fprintf(stderr, "[PERF] hardware counters not available (%s: %s): run without them\n", strerror(error),
+                error == EACCES || error == EPERM ? "see /proc/sys/kernel/perf_event_paranoid" : "no PMU exposed, e.g. virtual machine");
+        for (size_t i = 0; i < p.fds.size(); i++)
+            if (p.fds[i] >= 0) close(p.fds[i]);
+        p.fds.clear();
+        return 1;
+    }
+
+    //members that some thread could not open are closed everywhere; the others are read in order of creation
+    int position = 0;
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+        if (opened[e]) p.slot[e] = position++;
+        else
+            for (int t = 0; t < T; t++) {
+                int& fd = p.fds[(size_t)t * PERF_N_EVENTS + e];
+                if (fd >= 0) close(fd);
+                fd = -1;
+            }
+    }
+    p.n_threads = T;
+    return 0;
+#else
+    fprintf(stderr, "[PERF] hardware counters need Linux (perf_event_open): run without them\n");
+    return 1;
+#endif
+}
+
+//enables the groups from zero (p may be NULL: no counters)
+static inline void perf_counters_start(PerfCounters* p) {
+#ifdef __linux__
+    if (!p || p->n_threads == 0) return;
+    for (int t = 0; t < p->n_threads; t++) {
+        int leader = p->fds[(size_t)t * PERF_N_EVENTS];
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void)p;
+#endif
+}
+
+//disables the groups and adds what they counted since perf_counters_start
+static inline void perf_counters_stop(PerfCounters* p) {
+#ifdef __linux__
+    if (!p || p->n_threads == 0) return;
+    for (int t = 0; t < p->n_threads; t++)
+        ioctl(p->fds[(size_t)t * PERF_N_EVENTS], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    //nr, time enabled, time running, one value per member in order of creation
+    uint64_t data[3 + PERF_N_EVENTS];
+    for (int t = 0; t < p->n_threads; t++) {
+        if (read(p->fds[(size_t)t * PERF_N_EVENTS], data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t))) continue;
+        double scale = 1.0;
+        if (data[2] == 0) scale = 0.0;
+        else if (data[2] < data[1]) {
+            scale = (double)data[1] / data[2];
+            p->multiplexed = 1;
+        }
+        for (int e = 0; e < PERF_N_EVENTS; e++)
+            if (p->slot[e] >= 0 && (uint64_t)p->slot[e] < data[0])
+                p->counts[(size_t)t * PERF_N_EVENTS + e] += data[3 + p->slot[e]] * scale;
+    }
+    p->intervals++;
+#else
+    (void)p;
+#endif
+}
+
+static inline void perf_counters_close(PerfCounters& p) {
+    for (size_t i = 0; i < p.fds.size(); i++)
+        if (p.fds[i] >= 0) close(p.fds[i]);
+    p.fds.clear();
+    p.n_threads = 0;
+}
+
+//count, or -1 if the event is not available
+static inline double perf_count(const PerfCounters& p, const double* counts, int event) {
+    return p.slot[event] >= 0 ? counts[event] : -1.0;
+}
+
+static inline void perf_line(const PerfCounters& p, const char* who, const double* counts) {
+    double cycles = perf_count(p, counts, PERF_CYCLES), instructions = perf_count(p, counts, PERF_INSTRUCTIONS);
+    double l1 = perf_count(p, counts, PERF_L1_LOADS), l1_misses = perf_count(p, counts, PERF_L1_MISSES);
+    double llc = perf_count(p, counts, PERF_LLC_LOADS), llc_misses = perf_count(p, counts, PERF_LLC_MISSES);
+
+    fprintf(stderr, "[PERF] %s", who);
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+        if (p.slot[e] >= 0) fprintf(stderr, " | %s %.0f", perf_event_names[e], counts[e]);
+        else fprintf(stderr, " | %s n/a", perf_event_names[e]);
+    }
+    if (cycles > 0.0 && instructions >= 0.0) fprintf(stderr, " | IPC %.3f", instructions / cycles);
+    if (l1 > 0.0 && l1_misses >= 0.0) fprintf(stderr, " | L1 miss rate %.2f%%", 100.0 * l1_misses / l1);
+    if (llc > 0.0 && llc_misses >= 0.0) fprintf(stderr, " | LLC miss rate %.2f%%", 100.0 * llc_misses / llc);
+    fprintf(stderr, "\n");
+}
+
+/*ONE LINE PER THREAD AND ONE WITH THE SUM, ON stderr (NEXT TO THE perf stat OUTPUT IN THE PBS SCRIPTS), WITH THE TIMED SECONDS*/
+static inline void perf_counters_report(const PerfCounters& p, const char* filename, double seconds) {
+    if (p.n_threads == 0) return;
+    fprintf(stderr, "[PERF] %s | %d threads | %d timed interval%s | %.9f s%s\n", filename, p.n_threads, p.intervals,
+            p.intervals == 1 ? "" : "s", seconds, p.multiplexed ? " | multiplexed, counts scaled" : "");
+    double total[PERF_N_EVENTS] = {0};
+    char who[32];
+    for (int t = 0; t < p.n_threads; t++) {
+        const double* counts = &p.counts[(size_t)t * PERF_N_EVENTS];
+        for (int e = 0; e < PERF_N_EVENTS; e++) total[e] += counts[e];
+        snprintf(who, sizeof(who), "thread %d", t);
+        perf_line(p, who, counts);
+    }
+    perf_line(p, "total", total);
+}
+
+#endif
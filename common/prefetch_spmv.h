@@ -0,0 +1,83 @@
+#ifndef PREFETCH_SPMV_H
+#define PREFETCH_SPMV_H
+
+/*
+ * CSR SpMV WITH SOFTWARE PREFETCHING (--kernel=prefetch --prefetch-distance=d)
+ *
+ * The gather x[cols[idx]] is indirect, so the hardware prefetchers cannot predict it (they only follow the
+ * sequential streams of values and cols). Here, while computing entry idx, the kernel already asks for
+ *   - x[cols[idx + d]], the element of x needed d entries later (cols[idx + d] is in the sequential stream, so
+ *     reading it is cheap);
+ *   - the lines of values and cols 2*d entries ahead, once per cache line (every 8 values / 16 cols).
+ * d must cover the memory latency (about latency / time per entry) without evicting the prefetched lines before
+ * they are used, so the best value depends on the machine and on the matrix: --prefetch-distance=sweep measures
+ * the GFLOP/s for every d in {0, 1, 2, 4, ..., PREFETCH_SWEEP_MAX} (d = 0 is the kernel without prefetches).
+ * The prefetches run over the row ends (the next rows are the ones computed next by the same thread), and stop
+ * d entries before the end of the matrix.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+
+#define PREFETCH_DEFAULT_DISTANCE 32
+#define PREFETCH_SWEEP_MAX 512
+#define PREFETCH_SWEEP_REPS 10
+
+/*y = A*x PREFETCHING distance ENTRIES AHEAD*/
+static inline void spmv_prefetch(const CSRMatrix& csr, int distance, const double* x, double* y) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    int rows_number = csr.rows_number;
+    int nnz = rows_ptr[rows_number];
+    //distances beyond the matrix prefetch nothing; 2*d and idx + 2*d are in long long, so any int distance is safe
+    long long d = std::min(distance, nnz);
+    long long stream_end = nnz - 2 * d; //last entry whose stream lines 2*d ahead are inside the arrays
+
+    #pragma omp parallel for schedule(runtime)
+    for (int r = 0; r < rows_number; r++) {
+        double sum = 0.0;
+        int idx = rows_ptr[r], end = rows_ptr[r + 1];
+        if (d > 0) {
+            int prefetch_end = std::min(end, (int)(nnz - d));
+            for (; idx < prefetch_end; idx++) {
+                __builtin_prefetch(&x[cols[idx + d]], 0, 1);
+                if ((idx & 7) == 0 && idx < stream_end) {
+                    __builtin_prefetch(&values[idx + 2 * d], 0, 0);
+                    if ((idx & 15) == 0) __builtin_prefetch(&cols[idx + 2 * d], 0, 0);
+                }
+                sum += values[idx] * x[cols[idx]];
+            }
+        }
+        for (; idx < end; idx++)
+            sum += values[idx] * x[cols[idx]];
+        y[r] = sum;
+    }
+}
+
+/*
+ * SWEEP OF THE PREFETCH DISTANCE: for every d, best time of PREFETCH_SWEEP_REPS products (after one warm-up) and
+ * GFLOP/s = 2*nnz / time. One line per distance: matrix:prefetch-d<d>:best real time:GFLOP/s
+ */
+static inline void prefetch_sweep(const char* filename, const CSRMatrix& csr, const double* x, double* y) {
+    long long nnz = csr.rows_ptr[csr.rows_number];
+    for (int d = 0; d <= PREFETCH_SWEEP_MAX; d = d ? 2 * d : 1) {
+        spmv_prefetch(csr, d, x, y);    //warm-up
+        double best = 1e300;
+        for (int rep = 0; rep < PREFETCH_SWEEP_REPS; rep++) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            spmv_prefetch(csr, d, x, y);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            best = std::min(best, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+        }
+        printf("%s:prefetch-d%d:%.6f:%.3f\n", filename, d, best, best > 0 ? 2.0 * nnz / best / 1e9 : 0.0);
+    }
+}
+
+#endif
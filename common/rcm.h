@@ -0,0 +1,291 @@
+#ifndef RCM_H
+#define RCM_H
+
+/*
+ * REVERSE CUTHILL-McKEE REORDERING (--reorder=rcm)
+ *
+ * The gathers x[cols[idx]] of a row are scattered over the whole x when the nonzeros are far from the diagonal,
+ * and every one of them can be a cache miss. RCM renumbers rows and columns with the same permutation so that
+ * the nonzeros move close to the diagonal (small bandwidth): the rows that share columns become neighbours, so
+ * the part of x used by a block of rows is small and stays in cache.
+ *
+ * The permutation is computed on the pattern of A + A^T (the graph of the matrix, diagonal excluded):
+ *   1. for every connected component, a pseudo-peripheral start node: BFS from a node, then again from the
+ *      node of smallest degree of the last level, while the number of levels grows (George-Liu);
+ *   2. Cuthill-McKee: BFS from it, visiting the unvisited neighbours of every node by increasing degree;
+ *   3. the whole order is reversed (same bandwidth, smaller profile).
+ * The matrix becomes B = P*A*P^T, where row i of B is row perm[i] of A. x is permuted before the product
+ * (x'[i] = x[perm[i]]) and the result is taken back to the original order (y[perm[i]] = y'[i]), so
+ * B*x' = P*(A*x): the result is the same as without reordering. The reordering is done once, outside the timed
+ * region; its time is reported with the bandwidth and the profile before and after, so that it can be weighed
+ * against the time saved by every product.
+ * bandwidth = max |r - c| over the nonzeros, profile = sum over the rows of the span of the row including the
+ * diagonal (max(r, last column) - min(r, first column)).
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "mtx_parser.h"
+#include "csr_matrix.h"
+#include "spmv_options.h"
+
+struct Reordering {
+    int enabled;                //0: --reorder=none, the permutation is the identity
+    std::vector<int> perm;      //perm[new index] = old index
+    int bandwidth_before, bandwidth_after;
+    long long profile_before, profile_after;
+    double seconds;             //permutation + reordering of the matrix
+
+    Reordering() : enabled(0), bandwidth_before(0), bandwidth_after(0), profile_before(0), profile_after(0), seconds(0.0) {}
+};
+
+static inline void matrix_bandwidth(const CSRMatrix& csr, int& bandwidth, long long& profile) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    int max_band = 0;
+    long long sum = 0;
+
+    #pragma omp parallel for schedule(static) reduction(max:max_band) reduction(+:sum)
+    for (int r = 0; r < csr.rows_number; r++) {
+        if (rows_ptr[r] == rows_ptr[r + 1]) continue;
+        int first = cols[rows_ptr[r]], last = cols[rows_ptr[r + 1] - 1];     //the columns of a row are sorted
+        max_band = std::max(max_band, std::max(r - first, last - r));
+        sum += std::max(r, last) - std::min(r, first);
+    }
+    bandwidth = max_band;
+    profile = sum;
+}
+
+//adjacency lists of the pattern of A + A^T without the diagonal (sorted, without duplicates)
+static inline void symmetric_pattern(const CSRMatrix& csr, std::vector<int>& adj_ptr, std::vector<int>& adj) {
+    int n = csr.rows_number;
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+
+    adj_ptr.assign(n + 1, 0);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < n; r++) {
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+            int c = cols[idx];
+            if (c == r) continue;
+            #pragma omp atomic
+            adj_ptr[r]++;
+            #pragma omp atomic
+            adj_ptr[c]++;
+        }
+    }
+    parallel_exclusive_scan(adj_ptr.data(), n);
+
+    adj.resize(adj_ptr[n]);
+    std::vector<int> cursor(adj_ptr.begin(), adj_ptr.end() - 1);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < n; r++) {
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+            int c = cols[idx], pos;
+            if (c == r) continue;
+            #pragma omp atomic capture
+            pos = cursor[r]++;
+            adj[pos] = c;
+            #pragma omp atomic capture
+            pos = cursor[c]++;
+            adj[pos] = r;
+        }
+    }
+
+    //sorting and removal of the duplicates (a(r,c) and a(c,r) both stored), compacted in place
+    std::vector<int> length(n + 1, 0);
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int r = 0; r < n; r++) {
+        int* begin = adj.data() + adj_ptr[r];
+        int* end = adj.data() + adj_ptr[r + 1];
+        std::sort(begin, end);
+        length[r] = (int)(std::unique(begin, end) - begin);
+    }
+    int write = 0;
+    for (int r = 0; r < n; r++) {
+        int read = adj_ptr[r];
+        adj_ptr[r] = write;
+        for (int k = 0; k < length[r]; k++) adj[write++] = adj[read + k];
+    }
+    adj_ptr[n] = write;
+    adj.resize(write);
+}
+
+/*
+ * BFS FROM root OVER THE NODES NOT MARKED WITH stamp: queue receives the nodes by level, last_level the position
+ * of the first node of the last level. Returns the number of levels.
+ */
+static inline int rcm_levels(const int* adj_ptr, const int* adj, int root, std::vector<int>& mark, int stamp,
+                             std::vector<int>& queue, size_t& last_level) {
+    queue.clear();
+    queue.push_back(root);
+    mark[root] = stamp;
+    size_t level_start = 0;
+    int levels = 0;
+    while (level_start < queue.size()) {
+        size_t level_end = queue.size();
+        last_level = level_start;
+        levels++;
+        for (size_t i = level_start; i < level_end; i++) {
+            int v = queue[i];
+            for (int k = adj_ptr[v]; k < adj_ptr[v + 1]; k++)
+                if (mark[adj[k]] != stamp) {
+                    mark[adj[k]] = stamp;
+                    queue.push_back(adj[k]);
+                }
+        }
+        level_start = level_end;
+    }
+    return levels;
+}
+
+//perm[new index] = old index
+static inline void rcm_permutation(const std::vector<int>& adj_ptr, const std::vector<int>& adj, int n, std::vector<int>& perm) {
+    const int* ptr = adj_ptr.data();
+    std::vector<int> mark(n, -1), queue, neighbours;
+    std::vector<char> visited(n, 0);
+    perm.clear();
+    perm.reserve(n);
+    int stamp = 0;
+
+    for (int start = 0; start < n; start++) {
+        if (visited[start]) continue;
+
+        /*1. PSEUDO-PERIPHERAL NODE OF THE COMPONENT OF start*/
+        int root = start;
+        size_t last_level = 0;
+        int levels = rcm_levels(ptr, adj.data(), root, mark, stamp++, queue, last_level);
+        for (int iteration = 0; iteration < 8; iteration++) {
+            int candidate = queue[last_level];
+            for (size_t i = last_level; i < queue.size(); i++)
+                if (ptr[queue[i] + 1] - ptr[queue[i]] < ptr[candidate + 1] - ptr[candidate]) candidate = queue[i];
+            int candidate_levels = rcm_levels(ptr, adj.data(), candidate, mark, stamp++, queue, last_level);
+            if (candidate_levels <= levels) break;
+            root = candidate;
+            levels = candidate_levels;
+        }
+
+        /*2. CUTHILL-McKEE ORDER OF THE COMPONENT*/
+        size_t head = perm.size();
+        perm.push_back(root);
+        visited[root] = 1;
+        while (head < perm.size()) {
+            int v = perm[head++];
+            neighbours.clear();
+            for (int k = ptr[v]; k < ptr[v + 1]; k++)
+                if (!visited[adj[k]]) {
+                    visited[adj[k]] = 1;
+                    neighbours.push_back(adj[k]);
+                }
+            std::sort(neighbours.begin(), neighbours.end(), [ptr](int a, int b) {
+                int da = ptr[a + 1] - ptr[a], db = ptr[b + 1] - ptr[b];
+                return da < db || (da == db && a < b);
+            });
+            perm.insert(perm.end(), neighbours.begin(), neighbours.end());
+        }
+    }
+
+    /*3. REVERSE*/
+    std::reverse(perm.begin(), perm.end());
+}
+
+/*
+ * REPLACES THE MATRIX WITH P*A*P^T (ROW i = ROW perm[i] OF A, COLUMN c -> inverse[c]), REBUILT WITH build_csr.
+ * In half storage the entries that end up above the diagonal are moved below it (negated if skew-symmetric).
+ */
+static inline void permute_csr(CSRMatrix& csr, const std::vector<int>& perm) {
+    int n = csr.rows_number;
+    const int* rows_ptr = csr.rows_ptr;
+    std::vector<int> inverse(n);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) inverse[perm[i]] = i;
+
+    int half = csr.half_storage;
+    double sign = csr.is_symmetric == MTX_SKEW_SYMMETRIC ? -1.0 : 1.0;
+    std::vector<Node> matrix(csr.nnz);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < n; r++) {
+        int row = inverse[r];
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+            Node node(row, inverse[csr.cols[idx]], csr.values[idx]);
+            if (half && node.col > node.row) {
+                std::swap(node.row, node.col);
+                node.value *= sign;
+            }
+            matrix[idx] = node;
+        }
+    }
+
+    MtxHeader h;
+    h.rows_number = n;
+    h.columns_number = csr.columns_number;
+    h.nnz = csr.nnz;
+    h.is_symmetric = csr.is_symmetric;
+    h.is_pattern = 0;
+
+    //the new arrays are owned by the struct: the mapped cache (if any) is released
+    if (csr.map_base) {
+        munmap(csr.map_base, csr.map_size);
+        csr.map_base = NULL;
+        csr.map_size = 0;
+    }
+    build_csr(matrix, h, csr);
+    csr.half_storage = half;
+}
+
+/*x'[i] = x[perm[i]] FOR rows_number BLOCKS OF k VALUES (IN PLACE)*/
+static inline void permute_vector(const Reordering& ro, double* v, int rows_number, int k) {
+    if (!ro.enabled) return;
+    std::vector<double> tmp((size_t)rows_number * k);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < rows_number; i++)
+        for (int j = 0; j < k; j++) tmp[(size_t)i * k + j] = v[(size_t)ro.perm[i] * k + j];
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < (long long)rows_number * k; i++) v[i] = tmp[i];
+}
+
+/*y[perm[i]] = y'[i]: BACK TO THE ORIGINAL ORDER OF THE ROWS (IN PLACE)*/
+static inline void unpermute_vector(const Reordering& ro, double* v, int rows_number, int k) {
+    if (!ro.enabled) return;
+    std::vector<double> tmp((size_t)rows_number * k);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < rows_number; i++)
+        for (int j = 0; j < k; j++) tmp[(size_t)ro.perm[i] * k + j] = v[(size_t)i * k + j];
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < (long long)rows_number * k; i++) v[i] = tmp[i];
+}
+
+/*REORDERING OF THE MATRIX SELECTED BY --reorder, WITH THE REPORT ON stderr*/
+static inline int reorder_matrix(const SpmvOptions& opts, CSRMatrix& csr, Reordering& ro) {
+    ro.enabled = opts.reorder == REORDER_RCM;
+    if (!ro.enabled) return 0;
+    if (csr.rows_number != csr.columns_number) {
+        fprintf(stderr, "[ERR] --reorder=rcm needs a square matrix (%d x %d)\n", csr.rows_number, csr.columns_number);
+        return 1;
+    }
+
+    matrix_bandwidth(csr, ro.bandwidth_before, ro.profile_before);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    std::vector<int> adj_ptr, adj;
+    symmetric_pattern(csr, adj_ptr, adj);
+    rcm_permutation(adj_ptr, adj, csr.rows_number, ro.perm);
+    std::vector<int>().swap(adj);
+    permute_csr(csr, ro.perm);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ro.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    matrix_bandwidth(csr, ro.bandwidth_after, ro.profile_after);
+
+    fprintf(stderr, "[RCM] bandwidth %d -> %d | profile %lld -> %lld | reordering time %.6f s\n",
+            ro.bandwidth_before, ro.bandwidth_after, ro.profile_before, ro.profile_after, ro.seconds);
+    return 0;
+}
+
+#endif
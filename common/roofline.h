@@ -0,0 +1,119 @@
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+/*
+ * ROOFLINE OF THE TIMED PRODUCT (--roofline, OpenMP AND MPI BINARIES)
+ *
+ * SpMV does 2 flops per nonzero and reads at least 12 bytes for it, so it is limited by the memory bandwidth and
+ * the wall time alone does not say how far a schedule or a format is from what the node can do. Here:
+ *   - the sustainable bandwidth is measured with the STREAM triad a[i] = b[i] + s*c[i] on the same threads (same
+ *     team size and OMP_PROC_BIND/OMP_PLACES, schedule(static), arrays first touched by the threads that use them)
+ *     or, in the MPI binary, on all the ranks at the same time (a barrier before every run, the arrays of a rank
+ *     divided by the ranks of its node); every array is at least 4 times the largest cache,
+ *     the best of STREAM_REPETITIONS runs is taken and the bytes are counted as in STREAM (24 per element);
+ *   - the traffic of one product is modelled from the arrays of the format actually used: matrix (indices, values,
+ *     pointers, padding), x (the 64-byte lines of x reached by at least one nonzero, each read once) and y
+ *     (written once, plus the per-thread buffers or partial sums of the formats that have them);
+ *   - arithmetic intensity = flops / traffic, attainable = intensity * bandwidth, and the achieved GFLOP/s is
+ *     printed as a fraction of it.
+ * x is assumed to stay in cache once read: a matrix whose x gathers miss also gets below 100% for that reason.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "column_tiles.h"
+
+#define STREAM_REPETITIONS 10
+#define STREAM_MIN_BYTES (32LL << 20)  //bytes of every array when the cache size is unknown or small
+#define ROOFLINE_LINE 64                //bytes of a cache line
+
+//bytes of one product, by data structure
+struct RooflineTraffic {
+    double matrix;
+    double x;
+    double y;
+};
+
+static inline double traffic_bytes(const RooflineTraffic& t) {
+    return t.matrix + t.x + t.y;
+}
+
+//elements of every STREAM array for one of `sharing` processes of the node
+static inline long long stream_elements(int sharing) {
+    long long bytes = std::max(4 * detect_cache_size(), STREAM_MIN_BYTES) / std::max(sharing, 1);
+    return std::max(bytes / (long long)sizeof(double), 1LL << 17);
+}
+
+/*STREAM TRIAD ON n ELEMENTS WITH THE CURRENT TEAM, BEST BANDWIDTH IN BYTES/s (sync, IF GIVEN, IS CALLED BEFORE EVERY RUN)*/
+static inline double stream_triad(long long n, void (*sync)() = NULL) {
+    double* a = (double*)malloc(n * sizeof(double));
+    double* b = (double*)malloc(n * sizeof(double));
+    double* c = (double*)malloc(n * sizeof(double));
+    if (!a || !b || !c) {
+        free(a); free(b); free(c);
+        return 0.0;
+    }
+
+    //first touch by the threads of the triad
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < n; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    const double scalar = 3.0;
+    double best = 0.0;
+    for (int rep = 0; rep < STREAM_REPETITIONS; rep++) {
+        struct timespec start, end;
+        if (sync) sync();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < n; i++)
+            a[i] = b[i] + scalar * c[i];
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (rep == 0 || seconds < best) best = seconds;
+    }
+
+    //the result is read so the loop is not removed
+    volatile double check = a[n / 2];
+    (void)check;
+    free(a); free(b); free(c);
+    return best > 0.0 ? 3.0 * sizeof(double) * n / best : 0.0;
+}
+
+/*BYTES OF x READ BY THE PRODUCT: 64-BYTE LINES OF x CONTAINING AT LEAST ONE REACHED ELEMENT (element_bytes EACH)*/
+static inline double x_lines_bytes(const int* cols, long long nnz, long long columns, int element_bytes) {
+    long long lines = (columns * element_bytes + ROOFLINE_LINE - 1) / ROOFLINE_LINE;
+    std::vector<unsigned char> reached(lines, 0);
+    for (long long i = 0; i < nnz; i++) {
+        long long first = (long long)cols[i] * element_bytes;
+        long long last = first + element_bytes - 1;
+        for (long long l = first / ROOFLINE_LINE; l <= last / ROOFLINE_LINE; l++) reached[l] = 1;
+    }
+    long long count = 0;
+    for (long long l = 0; l < lines; l++) count += reached[l];
+    return (double)count * ROOFLINE_LINE;
+}
+
+//one [ROOFLINE] line on out (seconds: time of one product; who: "N threads" or "N ranks")
+static inline void roofline_report(FILE* out, const char* filename, const char* label, double flops, const RooflineTraffic& t,
+                                   double seconds, double bandwidth, const char* who) {
+    double bytes = traffic_bytes(t);
+    double intensity = bytes > 0.0 ? flops / bytes : 0.0;
+    double achieved = seconds > 0.0 ? flops / seconds / 1e9 : 0.0;
+    double attainable = intensity * bandwidth / 1e9;
+    fprintf(out, "[ROOFLINE] %s | %s | STREAM triad %.2f GB/s (%s) | traffic %.2f MB (matrix %.2f, x %.2f, y %.2f) | "
+                    "AI %.4f flop/byte | achieved %.3f GFLOP/s | attainable %.3f GFLOP/s | %.1f%% of attainable\n",
+            filename, label, bandwidth / 1e9, who, bytes / 1e6, t.matrix / 1e6, t.x / 1e6, t.y / 1e6, intensity, achieved,
+            attainable, attainable > 0.0 ? 100.0 * achieved / attainable : 0.0);
+}
+
+#endif
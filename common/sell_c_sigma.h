@@ -0,0 +1,191 @@
+#ifndef SELL_C_SIGMA_H
+#define SELL_C_SIGMA_H
+
+/*
+ * SELL-C-SIGMA (SLICED ELLPACK WITH SORTING WINDOW)
+ *
+ * Rows are grouped into chunks of C consecutive rows. Inside a chunk the entries are stored column-major
+ * (element j of lane l is at chunk_ptr[c] + j*C + l), so one SIMD instruction processes C rows at once;
+ * every chunk is padded to the length of its longest row (value 0, column 0).
+ * To reduce the padding, rows are sorted by decreasing length inside windows of sigma rows before being
+ * grouped (sigma = 1 means no sorting): row_perm keeps the original index of every stored row, so the
+ * result is written directly in the original order.
+ *
+ * The kernel accumulates every row in the same order as the CSR loop, so results are identical up to the
+ * fused multiply-add of the SIMD path.
+ */
+
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "csr_matrix.h"
+
+struct SellMatrix {
+    int C;
+    int sigma;
+    int rows_number;
+    int n_chunks;
+    std::vector<long long> chunk_ptr;   //offset of every chunk in cols/values (n_chunks + 1)
+    std::vector<int> chunk_len;         //length (longest row) of every chunk
+    std::vector<int> row_perm;          //original row stored in each slot, -1 for the padding slots of the last chunk
+    std::vector<int> cols;
+    std::vector<double> values;
+};
+
+/*CREATION OF THE SELL-C-SIGMA REPRESENTATION FROM THE CSR ONE*/
+static inline void build_sell(const CSRMatrix& csr, int C, int sigma, SellMatrix& sell) {
+    int rows_number = csr.rows_number;
+    const int* rows_ptr = csr.rows_ptr;
+
+    if (sigma < 1) sigma = 1;
+    sell.C = C;
+    sell.sigma = sigma;
+    sell.rows_number = rows_number;
+    sell.n_chunks = (rows_number + C - 1) / C;
+    int slots = sell.n_chunks * C;
+
+    /*SORTS THE ROWS BY DECREASING LENGTH INSIDE EVERY WINDOW OF SIGMA ROWS*/
+    sell.row_perm.resize(slots);
+    for (int i = rows_number; i < slots; i++) sell.row_perm[i] = -1;
+
+    int n_windows = (rows_number + sigma - 1) / sigma;
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int w = 0; w < n_windows; w++) {
+        int lo = w * sigma, hi = std::min(rows_number, lo + sigma);
+        for (int r = lo; r < hi; r++) sell.row_perm[r] = r;
+        if (sigma > 1)
+            std::stable_sort(sell.row_perm.begin() + lo, sell.row_perm.begin() + hi, [rows_ptr](int a, int b) {
+                return rows_ptr[a + 1] - rows_ptr[a] > rows_ptr[b + 1] - rows_ptr[b];
+            });
+    }
+
+    /*LENGTH OF EVERY CHUNK AND THEIR OFFSETS*/
+    sell.chunk_len.resize(sell.n_chunks);
+    sell.chunk_ptr.assign(sell.n_chunks + 1, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < sell.n_chunks; c++) {
+        int len = 0;
+        for (int l = 0; l < C; l++) {
+            int r = sell.row_perm[c * C + l];
+            if (r >= 0) len = std::max(len, rows_ptr[r + 1] - rows_ptr[r]);
+        }
+        sell.chunk_len[c] = len;
+    }
+    for (int c = 0; c < sell.n_chunks; c++)
+        sell.chunk_ptr[c + 1] = sell.chunk_ptr[c] + (long long)sell.chunk_len[c] * C;
+
+    /*COLUMN-MAJOR FILL OF EVERY CHUNK (PADDING: VALUE 0 IN COLUMN 0)*/
+    sell.cols.resize(sell.chunk_ptr[sell.n_chunks]);
+    sell.values.resize(sell.chunk_ptr[sell.n_chunks]);
+
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < sell.n_chunks; c++) {
+        long long base = sell.chunk_ptr[c];
+        int len = sell.chunk_len[c];
+        for (int l = 0; l < C; l++) {
+            int r = sell.row_perm[c * C + l];
+            int row_len = (r >= 0) ? rows_ptr[r + 1] - rows_ptr[r] : 0;
+            for (int j = 0; j < len; j++) {
+                long long pos = base + (long long)j * C + l;
+                if (j < row_len) {
+                    sell.cols[pos] = csr.cols[rows_ptr[r] + j];
+                    sell.values[pos] = csr.values[rows_ptr[r] + j];
+                }
+                else {
+                    sell.cols[pos] = 0;
+                    sell.values[pos] = 0.0;
+                }
+            }
+        }
+    }
+}
+
+//stored entries / useful entries (1.0 = no padding)
+static inline double sell_fill_ratio(const SellMatrix& sell, long long nnz) {
+    return nnz > 0 ? (double)sell.chunk_ptr[sell.n_chunks] / nnz : 1.0;
+}
+
+/*
+ * ONE CHUNK: acc[l] = SUM OVER j OF values[j*C + l] * x[cols[j*C + l]]
+ * The generic loop is used when no SIMD instruction set is available; AVX-512 handles 8 lanes per register,
+ * AVX2 4 lanes per register, both with a hardware gather of x.
+ */
+template <int C>
+static inline void sell_chunk(const int* cols, const double* values, int len, const double* x, double* acc) {
+#if defined(__AVX512F__)
+    if (C % 8 == 0) {
+        __m512d sum[C / 8 > 0 ? C / 8 : 1];
+        for (int g = 0; g < C / 8; g++) sum[g] = _mm512_setzero_pd();
+        for (int j = 0; j < len; j++) {
+            for (int g = 0; g < C / 8; g++) {
+                __m256i idx = _mm256_loadu_si256((const __m256i*)(cols + j * C + 8 * g));
+                __m512d xv = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, idx, x, 8);   //masked form: explicit source, no uninitialized warning
+                sum[g] = _mm512_fmadd_pd(_mm512_loadu_pd(values + j * C + 8 * g), xv, sum[g]);
+            }
+        }
+        for (int g = 0; g < C / 8; g++) _mm512_storeu_pd(acc + 8 * g, sum[g]);
+        return;
+    }
+#endif
+#if defined(__AVX2__)
+    if (C % 4 == 0) {
+        __m256d sum[C / 4];
+        for (int g = 0; g < C / 4; g++) sum[g] = _mm256_setzero_pd();
+        const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));   //all the lanes of the masked gather
+        for (int j = 0; j < len; j++) {
+            for (int g = 0; g < C / 4; g++) {
+                __m128i idx = _mm_loadu_si128((const __m128i*)(cols + j * C + 4 * g));
+                __m256d xv = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), x, idx, all, 8);
+#if defined(__FMA__)
+                sum[g] = _mm256_fmadd_pd(_mm256_loadu_pd(values + j * C + 4 * g), xv, sum[g]);
+#else
+                sum[g] = _mm256_add_pd(sum[g], _mm256_mul_pd(_mm256_loadu_pd(values + j * C + 4 * g), xv));
+#endif
+            }
+        }
+        for (int g = 0; g < C / 4; g++) _mm256_storeu_pd(acc + 4 * g, sum[g]);
+        return;
+    }
+#endif
+    for (int l = 0; l < C; l++) acc[l] = 0.0;
+    for (int j = 0; j < len; j++)
+        for (int l = 0; l < C; l++)
+            acc[l] += values[j * C + l] * x[cols[j * C + l]];
+}
+
+template <int C>
+static inline void spmv_sell_c(const SellMatrix& sell, const double* x, double* y) {
+    const long long* chunk_ptr = sell.chunk_ptr.data();
+    const int* chunk_len = sell.chunk_len.data();
+    const int* row_perm = sell.row_perm.data();
+    const int* cols = sell.cols.data();
+    const double* values = sell.values.data();
+    int n_chunks = sell.n_chunks;
+
+    #pragma omp parallel for schedule(runtime)
+    for (int c = 0; c < n_chunks; c++) {
+        double acc[C];
+        sell_chunk<C>(cols + chunk_ptr[c], values + chunk_ptr[c], chunk_len[c], x, acc);
+        for (int l = 0; l < C; l++) {
+            int r = row_perm[c * C + l];
+            if (r >= 0) y[r] = acc[l];
+        }
+    }
+}
+
+/*y = A*x WITH THE SELL-C-SIGMA MATRIX (C = 4, 8 OR 16)*/
+static inline void spmv_sell(const SellMatrix& sell, const double* x, double* y) {
+    switch (sell.C) {
+        case 4:  spmv_sell_c<4>(sell, x, y); break;
+        case 8:  spmv_sell_c<8>(sell, x, y); break;
+        default: spmv_sell_c<16>(sell, x, y); break;
+    }
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SPMM_H
+#define SPMM_H
+
+/*
+ * SpMM: Y = A*X FOR A BLOCK OF k VECTORS (k = 1..32)
+ *
+ * X and Y are row-major and interleaved: the k values of row i are X[i*k .. i*k + k), so one entry a(r,c) of the
+ * matrix is read once and multiplies k contiguous values of X (one or a few SIMD loads) into k accumulators that
+ * stay in registers. The matrix stream (values + cols) is shared by the k products.
+ * The kernel takes raw arrays so it is used both by the OpenMP binaries and by the local product of the MPI one;
+ * k is a template parameter, so the inner loop over the vectors is fully unrolled/vectorized.
+ */
+
+#define SPMM_MAX_VECTORS 32
+
+template <int K>
+static inline void spmm_rows(int rows_number, const int* rows_ptr, const int* cols, const double* values,
+                             const double* X, double* Y) {
+    #pragma omp parallel for schedule(runtime)
+    for (int r = 0; r < rows_number; r++) {
+        double acc[K];
+        for (int j = 0; j < K; j++) acc[j] = 0.0;
+
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+            double a = values[idx];
+            const double* xr = X + (size_t)cols[idx] * K;
+            for (int j = 0; j < K; j++) acc[j] += a * xr[j];
+        }
+        for (int j = 0; j < K; j++) Y[(size_t)r * K + j] = acc[j];
+    }
+}
+
+#define SPMM_CASE(k) case k: spmm_rows<k>(rows_number, rows_ptr, cols, values, X, Y); break;
+
+/*Y = A*X WITH k = 1..SPMM_MAX_VECTORS INTERLEAVED VECTORS*/
+static inline void spmm(int k, int rows_number, const int* rows_ptr, const int* cols, const double* values,
+                        const double* X, double* Y) {
+    switch (k) {
+        SPMM_CASE(1)  SPMM_CASE(2)  SPMM_CASE(3)  SPMM_CASE(4)  SPMM_CASE(5)  SPMM_CASE(6)  SPMM_CASE(7)  SPMM_CASE(8)
+        SPMM_CASE(9)  SPMM_CASE(10) SPMM_CASE(11) SPMM_CASE(12) SPMM_CASE(13) SPMM_CASE(14) SPMM_CASE(15) SPMM_CASE(16)
+        SPMM_CASE(17) SPMM_CASE(18) SPMM_CASE(19) SPMM_CASE(20) SPMM_CASE(21) SPMM_CASE(22) SPMM_CASE(23) SPMM_CASE(24)
+        SPMM_CASE(25) SPMM_CASE(26) SPMM_CASE(27) SPMM_CASE(28) SPMM_CASE(29) SPMM_CASE(30) SPMM_CASE(31) SPMM_CASE(32)
+        default: break;
+    }
+}
+
+#undef SPMM_CASE
+
+#endif
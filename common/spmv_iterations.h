@@ -0,0 +1,228 @@
+#ifndef SPMV_ITERATIONS_H
+#define SPMV_ITERATIONS_H
+
+/*
+ * REPEATED PRODUCTS WITH WARM-UP (--iterations=N --warmup=W)
+ *
+ * A single cold SpMV also measures the creation of the thread team and the page faults of the first touch of y,
+ * which on the small matrices (bmwcra_1: about 0.03 s) is most of the time. In this mode W untimed products are
+ * followed by N timed ones, and the output of every product is the input of the next one (power iteration):
+ * y is divided by its largest element so the values neither overflow nor become denormal. The matrix must be
+ * square.
+ *
+ * For the CSR loop of the schedule*.cpp files (double precision, one vector) all the W + N products run inside
+ * one parallel region: the rows are shared with an orphaned "omp for schedule(runtime)" (same clause as the file),
+ * x and y are swapped by pointer, and the normalization is fused in the loop (every row is multiplied by 1/max of
+ * the previous product; each thread leaves its max in its own slot, one set of slots per iteration parity so a slot
+ * is never rewritten while another thread is still reading it). The master thread takes a time stamp after the
+ * barrier that ends every timed product, and a second barrier keeps the other threads from starting the next one
+ * before the stamp, so every interval contains exactly one product (the sum is the same without it).
+ * The other kernels have their own parallel regions, so they are called once per product and the normalization
+ * (a separate pass) is left out of the timed intervals.
+ * With --perf-counters the counter groups (perf_counters.h) are enabled just before the first time stamp and disabled
+ * after the last one (persistent region), or around every timed product (other kernels).
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+#include "spmv_kernels.h"
+#include "bench_harness.h"
+#include "perf_counters.h"
+
+#define ITERATIONS_SLOT 8       //doubles per slot of the thread maxima (one cache line)
+
+struct IterationTimes {
+    int iterations;
+    double cpu;                     //cpu time of the timed products (clock())
+    double real;                    //real time of the timed products
+    std::vector<double> latency;    //real time of every timed product
+};
+
+static inline double iteration_clock() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//x = y / max|y| (max over the n elements, x unchanged if y is 0)
+static inline void normalize_into(int n, const double* y, double* x) {
+    double max_value = 0.0;
+    #pragma omp parallel for schedule(static) reduction(max:max_value)
+    for (int i = 0; i < n; i++) max_value = std::max(max_value, fabs(y[i]));
+    if (max_value == 0.0) return;
+    double scale = 1.0 / max_value;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) x[i] = y[i] * scale;
+}
+
+/*W + N CSR PRODUCTS IN ONE PARALLEL REGION; THE LAST PRODUCT IS LEFT IN y (x IS OVERWRITTEN)*/
+static inline void persistent_csr_iterations(const CSRMatrix& csr, int warmup, int iterations, double* x, double* y,
+                                             IterationTimes& times, PerfCounters* counters = NULL) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    int rows_number = csr.rows_number;
+    int total = warmup + iterations;
+#ifdef _OPENMP
+    int max_threads = omp_get_max_threads();
+#else
+    int max_threads = 1;
+#endif
+
+    std::vector<double> thread_max((size_t)2 * max_threads * ITERATIONS_SLOT, 0.0);
+    std::vector<double> stamps(iterations + 1);
+    clock_t cpu_start = 0, cpu_end = 0;
+    double* last = y;
+
+    #pragma omp parallel
+    {
+#ifdef _OPENMP
+        int tid = omp_get_thread_num(), n_threads = omp_get_num_threads();
+#else
+        int tid = 0, n_threads = 1;
+#endif
+        double* in = x;
+        double* out = y;
+        double scale = 1.0;
+
+        for (int it = 0; it < total; it++) {
+            if (it == warmup) {
+                #pragma omp barrier
+                #pragma omp master
+                {
+                    perf_counters_start(counters);
+                    stamps[0] = iteration_clock();
+                    cpu_start = clock();
+                }
+                #pragma omp barrier
+            }
+
+            double local_max = 0.0;
+            #pragma omp for schedule(runtime) nowait
+            for (int r = 0; r < rows_number; r++) {
+                double sum = 0.0;
+                for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++)
+                    sum += values[idx] * in[cols[idx]];
+                sum *= scale;
+                out[r] = sum;
+                local_max = std::max(local_max, fabs(sum));
+            }
+            double* slots = &thread_max[(size_t)(it & 1) * max_threads * ITERATIONS_SLOT];
+            slots[tid * ITERATIONS_SLOT] = local_max;
+            #pragma omp barrier
+
+            if (it >= warmup) {
+                #pragma omp master
+                stamps[it - warmup + 1] = iteration_clock();
+                #pragma omp barrier
+            }
+
+            double max_value = 0.0;
+            for (int t = 0; t < n_threads; t++) max_value = std::max(max_value, slots[t * ITERATIONS_SLOT]);
+            scale = max_value > 0.0 ? 1.0 / max_value : 1.0;
+            std::swap(in, out);
+        }
+
+        #pragma omp master
+        {
+            perf_counters_stop(counters);
+            cpu_end = clock();
+            last = in;      //output of the last product (swapped into in)
+        }
+    }
+
+    if (last != y) memcpy(y, last, (size_t)rows_number * sizeof(double));
+
+    times.iterations = iterations;
+    times.cpu = (double)(cpu_end - cpu_start) / CLOCKS_PER_SEC;
+    times.real = stamps[iterations] - stamps[0];
+    times.latency.resize(iterations);
+    for (int i = 0; i < iterations; i++) times.latency[i] = stamps[i + 1] - stamps[i];
+}
+
+/*W + N PRODUCTS OF ANY KERNEL, ONE CALL EACH: AT THE END y = A*x (x IS THE NORMALIZED OUTPUT OF THE PREVIOUS PRODUCT)*/
+static inline void kernel_iterations(SpmvKernel& kernel, int warmup, int iterations, double* x, double* y,
+                                     IterationTimes& times, PerfCounters* counters = NULL) {
+    int n = kernel.csr->rows_number * kernel.vectors;
+    int total = warmup + iterations;
+    times.iterations = iterations;
+    times.cpu = 0.0;
+    times.real = 0.0;
+    times.latency.resize(iterations);
+
+    for (int it = 0; it < total; it++) {
+        if (it >= warmup) perf_counters_start(counters);
+        clock_t cpu_start = clock();
+        double start = iteration_clock();
+        run_kernel(kernel, x, y);
+        double end = iteration_clock();
+        clock_t cpu_end = clock();
+        if (it >= warmup) perf_counters_stop(counters);
+
+        if (it >= warmup) {
+            times.latency[it - warmup] = end - start;
+            times.real += end - start;
+            times.cpu += (double)(cpu_end - cpu_start) / CLOCKS_PER_SEC;
+        }
+        if (it + 1 < total) normalize_into(n, y, x);
+    }
+}
+
+//repeated products of the selected kernel (the persistent region for the plain CSR loop)
+static inline void run_iterations(const SpmvOptions& opts, SpmvKernel& kernel, double* x, double* y, IterationTimes& times,
+                                  PerfCounters* counters = NULL) {
+    if (default_csr_loop(opts))
+        persistent_csr_iterations(*kernel.csr, opts.warmup, opts.iterations, x, y, times, counters);
+    else
+        kernel_iterations(kernel, opts.warmup, opts.iterations, x, y, times, counters);
+}
+
+/*
+ * RECORD OF THE TIMED PRODUCTS FOR --bench-output: schedule and threads are the ones in use (omp_get_schedule,
+ * omp_get_max_threads); with the half storage the flops count both triangles, the bytes the stored entries only
+ */
+static inline int write_bench_record(const SpmvOptions& opts, const CSRMatrix& csr, const char* label, const IterationTimes& times) {
+    BenchRecord r;
+    r.matrix = bench_basename(opts.matrix_path);
+    r.kernel = label;
+    r.threads = 1;
+    r.schedule = "-";
+#ifdef _OPENMP
+    omp_sched_t kind;
+    int chunk;
+    omp_get_schedule(&kind, &chunk);
+    int k = (int)kind & 0xff;     //without the monotonic modifier
+    char schedule[32];
+    snprintf(schedule, sizeof(schedule), "%s,%d", k >= SCHEDULE_STATIC && k <= SCHEDULE_GUIDED ? schedule_names[k] : "auto", chunk);
+    r.schedule = schedule;
+    r.threads = omp_get_max_threads();
+#endif
+    r.ranks = 1;
+    r.rows = csr.rows_number;
+    r.columns = csr.columns_number;
+    r.nnz = csr_product_nonzeros(csr);
+    r.vectors = opts.vectors;
+    r.warmup = opts.warmup;
+    r.bytes = csr_traffic_bytes(csr.rows_number, csr.columns_number, csr.nnz, opts.precision == PRECISION_DOUBLE ? 8 : 4, opts.vectors);
+    r.stats = bench_stats(times.latency);
+    return bench_write(opts.bench_output, r);
+}
+
+//mean and min latency of the timed products
+static inline double mean_latency(const IterationTimes& times) {
+    return times.iterations ? times.real / times.iterations : 0.0;
+}
+
+static inline double min_latency(const IterationTimes& times) {
+    return times.latency.empty() ? 0.0 : *std::min_element(times.latency.begin(), times.latency.end());
+}
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef SPMV_KERNELS_H
+#define SPMV_KERNELS_H
+
+/*
+ * SpMV KERNELS SELECTABLE FROM THE COMMAND LINE (--kernel=...)
+ *
+ * prepare_kernel() builds the storage format needed by the kernel (outside the timed region),
+ * run_kernel() computes y = A*x.
+ * All the loops use schedule(runtime): every schedule*.cpp sets the runtime schedule to its own clause,
+ * so the other kernels are compared under the same scheduling as the CSR loop of the file
+ * (except merge, sym, balanced and tiled, which split the work by themselves and do not depend on the schedule).
+ * The sym kernel needs the matrix loaded in half storage: load_csr(filename, csr, opts.kernel == KERNEL_SYM).
+ * With --transpose the csr kernel computes y = A^T*x instead (transpose_spmv.h).
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "csr_matrix.h"
+#include "sell_c_sigma.h"
+#include "bcsr.h"
+#include "merge_spmv.h"
+#include "sym_spmv.h"
+#include "csr_delta.h"
+#include "row_partition.h"
+#include "column_tiles.h"
+#include "prefetch_spmv.h"
+#include "transpose_spmv.h"
+#include "bucket_csr.h"
+#include "spmm.h"
+#include "spmv_options.h"
+#include "roofline.h"
+
+struct SpmvKernel {
+    int kind;
+    const CSRMatrix* csr;
+    SellMatrix sell;
+    BcsrMatrix bcsr;
+    SymSpmv sym;
+    DeltaCsr delta;
+    RowPartition partition;         //nnz-balanced blocks of rows (KERNEL_BALANCED)
+    TiledCsr tiles;
+    TransposeSpmv transpose;        //y = A^T*x (method TRANSPOSE_OFF: not used)
+    BucketCsr buckets;
+    int prefetch_distance;
+    int precision;
+    int vectors;                    //k > 1: x and y are interleaved blocks of k vectors (SpMM)
+    std::vector<float> values_f;    //values in float (PRECISION_FLOAT, PRECISION_FLOAT_X)
+    std::vector<float> x_f;         //x in float (PRECISION_FLOAT_X)
+    char label[32];     //name printed in the output line (e.g. "bcsr3x3", "csr-float")
+};
+
+//reference CSR kernel (same loop as the schedule*.cpp files)
+static inline void spmv_csr(const CSRMatrix& csr, const double* x, double* y) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    int rows_number = csr.rows_number;
+
+    #pragma omp parallel for schedule(runtime)
+    for (int r = 0; r < rows_number; r++) {
+        double sum = 0.0;
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++)
+            sum += values[idx] * x[cols[idx]];
+        y[r] = sum;
+    }
+}
+
+/*
+ * MIXED PRECISION CSR: VT (value) AND XT (x) ARE float OR double, THE SUM OF EVERY ROW IS ALWAYS IN double.
+ * With float values the stream is 8 bytes per nonzero instead of 12.
+ */
+template <typename VT, typename XT>
+static inline void spmv_csr_mixed(const CSRMatrix& csr, const VT* values, const XT* x, double* y) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    int rows_number = csr.rows_number;
+
+    #pragma omp parallel for schedule(runtime)
+    for (int r = 0; r < rows_number; r++) {
+        double sum = 0.0;
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++)
+            sum += (double)values[idx] * (double)x[cols[idx]];
+        y[r] = sum;
+    }
+}
+
+//max over the rows of |y - reference| / |reference| (absolute difference where the reference is 0)
+static inline double max_relative_error(const double* y, const double* reference, int n) {
+    double max_error = 0.0;
+    #pragma omp parallel for schedule(static) reduction(max:max_error)
+    for (int i = 0; i < n; i++) {
+        double diff = fabs(y[i] - reference[i]);
+        double error = reference[i] != 0.0 ? diff / fabs(reference[i]) : diff;
+        if (error > max_error) max_error = error;
+    }
+    return max_error;
+}
+
+//1 if the run is the plain double CSR SpMV, computed by the loop of the source file itself
+static inline int default_csr_loop(const SpmvOptions& opts) {
+    return opts.kernel == KERNEL_CSR && opts.precision == PRECISION_DOUBLE && opts.vectors == 1 && opts.transpose == TRANSPOSE_OFF;
+}
+
+static inline int prepare_kernel(const SpmvOptions& opts, const CSRMatrix& csr, SpmvKernel& kernel) {
+    kernel.kind = opts.kernel;
+    kernel.csr = &csr;
+    kernel.precision = opts.precision;
+    kernel.vectors = opts.vectors;
+    kernel.prefetch_distance = opts.prefetch_distance;
+
+    if (opts.vectors > 1 && (opts.kernel != KERNEL_CSR || opts.precision != PRECISION_DOUBLE)) {
+        fprintf(stderr, "[ERR] --vectors is only available with the csr kernel in double precision\n");
+        return 1;
+    }
+
+    if (opts.precision != PRECISION_DOUBLE && opts.kernel == KERNEL_BUCKETED) {
+        if (opts.precision != PRECISION_FLOAT) {
+            fprintf(stderr, "[ERR] The bucketed kernel stores the values in double or float, x is always double\n");
+            return 1;
+        }
+    }
+    else if (opts.precision != PRECISION_DOUBLE) {
+        if (opts.kernel != KERNEL_CSR) {
+            fprintf(stderr, "[ERR] --precision=%s is only available with the csr kernel\n", precision_names[opts.precision]);
+            return 1;
+        }
+        kernel.values_f.resize(csr.nnz);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < csr.nnz; i++) kernel.values_f[i] = (float)csr.values[i];
+        if (opts.precision == PRECISION_FLOAT_X) kernel.x_f.resize(csr.columns_number);
+    }
+
+    if (opts.solver == SOLVER_CG && (opts.kernel != KERNEL_CSR || opts.precision != PRECISION_DOUBLE || opts.vectors > 1 ||
+                                     csr.rows_number != csr.columns_number)) {
+        fprintf(stderr, "[ERR] --solver=cg needs a square matrix and the csr kernel in double precision with one vector\n");
+        return 1;
+    }
+
+    if (opts.transpose != TRANSPOSE_OFF && (opts.kernel != KERNEL_CSR || opts.precision != PRECISION_DOUBLE || opts.vectors > 1 ||
+                                            opts.solver != SOLVER_SPMV || csr.rows_number != csr.columns_number)) {
+        fprintf(stderr, "[ERR] --transpose needs a square matrix and the csr kernel in double precision with one vector (no --solver)\n");
+        return 1;
+    }
+    if (opts.transpose != TRANSPOSE_OFF)
+        prepare_transpose(csr, opts.transpose, opts.transpose_budget, kernel.transpose);
+
+    if (opts.iterations > 0 && csr.rows_number != csr.columns_number) {
+        fprintf(stderr, "[ERR] --iterations needs a square matrix (the result is the next x)\n");
+        return 1;
+    }
+
+    if (opts.kernel == KERNEL_SYM && !csr.half_storage) {
+        fprintf(stderr, "[ERR] The sym kernel needs a symmetric (or skew-symmetric) matrix\n");
+        return 1;
+    }
+
+    switch (opts.kernel) {
+        case KERNEL_SELL:
+            build_sell(csr, opts.sell_c, opts.sell_sigma, kernel.sell);
+            break;
+        case KERNEL_BCSR: {
+            int R = opts.bcsr_r, C = opts.bcsr_c;
+            if (R == 0) bcsr_choose_block(csr, R, C);
+            build_bcsr(csr, R, C, kernel.bcsr);
+            break;
+        }
+        case KERNEL_SYM:
+            prepare_sym(csr, kernel.sym);
+            break;
+        case KERNEL_DELTA:
+            build_delta(csr, kernel.delta);
+            break;
+        case KERNEL_BALANCED:
+            build_row_partition(csr, kernel.partition);
+            break;
+        case KERNEL_TILED:
+            build_tiles(csr, opts.cache_size, kernel.tiles);
+            break;
+        case KERNEL_BUCKETED:
+            build_buckets(csr, opts.precision == PRECISION_FLOAT, kernel.buckets);
+            break;
+        default:
+            break;
+    }
+
+    if (opts.kernel == KERNEL_BCSR)
+        snprintf(kernel.label, sizeof(kernel.label), "bcsr%dx%d", kernel.bcsr.R, kernel.bcsr.C);
+    else if (opts.kernel == KERNEL_TILED)
+        snprintf(kernel.label, sizeof(kernel.label), "tiled%d", kernel.tiles.n_panels);
+    else if (opts.kernel == KERNEL_BUCKETED)
+        snprintf(kernel.label, sizeof(kernel.label), "bucketed-i%d%s", kernel.buckets.index_bits,
+                 kernel.buckets.value_float ? "-float" : "");
+    else if (opts.transpose != TRANSPOSE_OFF)
+        snprintf(kernel.label, sizeof(kernel.label), "transpose-%s", transpose_names[kernel.transpose.method]);
+    else if (opts.kernel == KERNEL_PREFETCH)
+        snprintf(kernel.label, sizeof(kernel.label), "prefetch-d%d", opts.prefetch_distance);
+    else if (opts.precision != PRECISION_DOUBLE)
+        snprintf(kernel.label, sizeof(kernel.label), "%s-%s", kernel_names[opts.kernel], precision_names[opts.precision]);
+    else if (opts.vectors > 1)
+        snprintf(kernel.label, sizeof(kernel.label), "spmm-k%d", opts.vectors);
+    else
+        snprintf(kernel.label, sizeof(kernel.label), "%s", kernel_names[opts.kernel]);
+    return 0;
+}
+
+//what the prepared kernel decided by itself (transpose method, row buckets), on stderr
+static inline void kernel_report(const SpmvKernel& kernel) {
+    if (kernel.transpose.method != TRANSPOSE_OFF) transpose_report(kernel.transpose);
+    if (kernel.kind == KERNEL_BUCKETED) bucket_report(kernel.buckets);
+}
+
+/*
+ * BYTES OF ONE PRODUCT OF THE PREPARED KERNEL (roofline.h): THE ARRAYS OF ITS FORMAT, THE LINES OF x REACHED BY THE
+ * NONZEROS AND y, WITH THE PER-THREAD BUFFERS (sym, transpose) AND THE PARTIAL SUMS OF EVERY PANEL (tiled) AS y TRAFFIC
+ */
+static inline RooflineTraffic kernel_traffic(const SpmvKernel& kernel) {
+    const CSRMatrix& csr = *kernel.csr;
+    double rows = csr.rows_number, columns = csr.columns_number, nnz = csr.nnz;
+    double csr_bytes = (rows + 1) * sizeof(int) + nnz * (sizeof(int) + sizeof(double));
+    RooflineTraffic t;
+    t.matrix = csr_bytes;
+    t.x = x_lines_bytes(csr.cols, csr.nnz, csr.columns_number, sizeof(double) * kernel.vectors);
+    t.y = rows * sizeof(double) * kernel.vectors;
+
+    if (kernel.transpose.method != TRANSPOSE_OFF) {
+        //x[r] is read once per row, y has one element per column
+        const TransposeSpmv& tr = kernel.transpose;
+        t.x = rows * sizeof(double);
+        t.y = columns * sizeof(double);
+        if (tr.method == TRANSPOSE_CSC) t.matrix = tr.csc_bytes;
+        else t.y += 2.0 * tr.buffer_bytes;     //buffers written by the scatter, read by the reduction
+        return t;
+    }
+    if (kernel.precision == PRECISION_FLOAT || kernel.precision == PRECISION_FLOAT_X)
+        t.matrix = (rows + 1) * sizeof(int) + nnz * (sizeof(int) + sizeof(float));
+    if (kernel.precision == PRECISION_FLOAT_X)  //conversion of x (read in double, written in float), then float gathers
+        t.x = columns * (sizeof(double) + sizeof(float)) + x_lines_bytes(csr.cols, csr.nnz, csr.columns_number, sizeof(float));
+
+    switch (kernel.kind) {
+        case KERNEL_SELL: {
+            const SellMatrix& s = kernel.sell;
+            t.matrix = (s.n_chunks + 1.0) * sizeof(long long) + s.n_chunks * sizeof(int) + s.row_perm.size() * sizeof(int) +
+                       s.cols.size() * sizeof(int) + s.values.size() * sizeof(double);
+            break;
+        }
+        case KERNEL_BCSR: {
+            const BcsrMatrix& b = kernel.bcsr;
+            t.matrix = b.brow_ptr.size() * sizeof(int) + b.bcols.size() * sizeof(int) + b.values.size() * sizeof(double);
+            break;
+        }
+        case KERNEL_SYM:
+            //x[r] is also read for the mirrored entries of every row, so the whole x is reached
+            t.x = std::max(t.x, columns * sizeof(double));
+            if (!kernel.sym.use_atomic) t.y += 2.0 * kernel.sym.buffers.size() * sizeof(double);
+            break;
+        case KERNEL_DELTA: {
+            const DeltaCsr& d = kernel.delta;
+            t.matrix = (rows + 1) * sizeof(int) + d.row_base.size() * sizeof(int) + d.chunk_width.size() +
+                       d.chunk_offset.size() * sizeof(long long) + delta_index_bytes(d) + nnz * sizeof(double);
+            break;
+        }
+        case KERNEL_TILED: {
+            const TiledCsr& tl = kernel.tiles;
+            t.matrix = tl.first_seg.size() * sizeof(long long) + tl.seg_row.size() * sizeof(int) +
+                       tl.seg_ptr.size() * sizeof(long long) + tl.cols.size() * sizeof(int) + tl.values.size() * sizeof(double);
+            t.y = std::max(t.y, tl.seg_row.size() * (double)sizeof(double));     //one partial sum per segment
+            break;
+        }
+        case KERNEL_BUCKETED: {
+            const BucketCsr& b = kernel.buckets;
+            t.matrix = b.rows.size() * sizeof(int) + b.generic_ptr.size() * sizeof(long long) +
+                       nnz * (b.index_bits / 8 + (b.value_float ? sizeof(float) : sizeof(double)));
+            break;
+        }
+        default:
+            break;
+    }
+    return t;
+}
+
+/*
+ * --roofline: STREAM TRIAD WITH THE TEAM OF THE PRODUCT (AFTER THE TIMED REGION, SO THE CACHES OF THE PRODUCT ARE NOT
+ * TOUCHED BEFORE IT), THEN ACHIEVED AGAINST ATTAINABLE GFLOP/s OF THE KERNEL, ON stderr (seconds: TIME OF ONE PRODUCT)
+ */
+static inline void kernel_roofline(const char* filename, const SpmvKernel& kernel, double seconds) {
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    double bandwidth = stream_triad(stream_elements(1));
+    char who[32];
+    snprintf(who, sizeof(who), "%d threads", threads);
+    double flops = 2.0 * csr_product_nonzeros(*kernel.csr) * kernel.vectors;
+    roofline_report(stderr, filename, kernel.label, flops, kernel_traffic(kernel), seconds, bandwidth, who);
+}
+
+static inline void run_kernel(SpmvKernel& kernel, const double* x, double* y) {
+    if (kernel.transpose.method != TRANSPOSE_OFF) {
+        spmv_transpose(kernel.transpose, x, y);
+        return;
+    }
+    if (kernel.kind == KERNEL_BUCKETED) {
+        spmv_bucketed(kernel.buckets, x, y);
+        return;
+    }
+    if (kernel.vectors > 1) {
+        const CSRMatrix& csr = *kernel.csr;
+        spmm(kernel.vectors, csr.rows_number, csr.rows_ptr, csr.cols, csr.values, x, y);
+        return;
+    }
+    if (kernel.precision == PRECISION_FLOAT) {
+        spmv_csr_mixed(*kernel.csr, kernel.values_f.data(), x, y);
+        return;
+    }
+    if (kernel.precision == PRECISION_FLOAT_X) {
+        //x is converted inside the timed region: the conversion is part of the cost of the float-x mode
+        float* x_f = kernel.x_f.data();
+        int n = (int)kernel.x_f.size();
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) x_f[i] = (float)x[i];
+        spmv_csr_mixed(*kernel.csr, kernel.values_f.data(), (const float*)x_f, y);
+        return;
+    }
+
+    switch (kernel.kind) {
+        case KERNEL_SELL:
+            spmv_sell(kernel.sell, x, y);
+            break;
+        case KERNEL_BCSR:
+            spmv_bcsr(kernel.bcsr, x, y);
+            break;
+        case KERNEL_MERGE:
+            spmv_merge(*kernel.csr, x, y);
+            break;
+        case KERNEL_SYM:
+            spmv_sym(kernel.sym, x, y);
+            break;
+        case KERNEL_DELTA:
+            spmv_delta(kernel.delta, x, y);
+            break;
+        case KERNEL_BALANCED:
+            spmv_balanced(kernel.partition, *kernel.csr, x, y);
+            break;
+        case KERNEL_TILED:
+            spmv_tiled(kernel.tiles, x, y);
+            break;
+        case KERNEL_PREFETCH:
+            spmv_prefetch(*kernel.csr, kernel.prefetch_distance, x, y);
+            break;
+        default:
+            spmv_csr(*kernel.csr, x, y);
+            break;
+    }
+}
+
+#endif
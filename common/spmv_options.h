@@ -0,0 +1,465 @@
+#ifndef SPMV_OPTIONS_H
+#define SPMV_OPTIONS_H
+
+/*
+ * COMMAND LINE OF THE OpenMP BINARIES
+ *
+ *   ./executable <matrix.mtx> [options]
+ *
+ * Without options the binaries behave exactly as before (CSR kernel, same output line).
+ * The engine (spmv_engine.cpp) also accepts --schedule, --threads and --tune: every choice that is not given
+ * on the command line is left unset (-1 / 0) and decided by the auto-tuner (see autotune.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define KERNEL_CSR 0
+#define KERNEL_SELL 1
+#define KERNEL_BCSR 2
+#define KERNEL_MERGE 3
+#define KERNEL_SYM 4
+#define KERNEL_DELTA 5
+#define KERNEL_BALANCED 6
+#define KERNEL_TILED 7
+#define KERNEL_PREFETCH 8
+#define KERNEL_BUCKETED 9
+#define KERNEL_COUNT 10
+
+static const char* const kernel_names[KERNEL_COUNT] = {"csr", "sell", "bcsr", "merge", "sym", "delta", "balanced", "tiled",
+                                                       "prefetch", "bucketed"};
+
+//storage precision (the accumulation is always in double)
+#define PRECISION_DOUBLE 0      //values and x in double
+#define PRECISION_FLOAT 1       //values in float
+#define PRECISION_FLOAT_X 2     //values and x in float
+#define PRECISION_COUNT 3
+
+static const char* const precision_names[PRECISION_COUNT] = {"double", "float", "float-x"};
+
+//OpenMP schedule kinds, same values as omp_sched_t (schedule(runtime) is set with omp_set_schedule)
+#define SCHEDULE_STATIC 1
+#define SCHEDULE_DYNAMIC 2
+#define SCHEDULE_GUIDED 3
+
+static const char* const schedule_names[4] = {"", "static", "dynamic", "guided"};
+
+//engine: use the tuning cache or search (auto), always search (force), no tuning (off)
+#define TUNE_AUTO 0
+#define TUNE_FORCE 1
+#define TUNE_OFF 2
+
+static const char* const tune_names[3] = {"auto", "force", "off"};
+
+//NUMA placement of the CSR arrays and of the vectors (see numa_placement.h)
+#define PLACEMENT_NONE 0            //arrays written by the main thread (or mapped from the cache)
+#define PLACEMENT_FIRST_TOUCH 1     //every array first touched by the threads that use its rows
+#define PLACEMENT_INTERLEAVE 2      //as first-touch, but x interleaved over all the nodes
+
+static const char* const placement_names[3] = {"none", "first-touch", "interleave"};
+
+//reordering of rows and columns before the product (see rcm.h)
+#define REORDER_NONE 0
+#define REORDER_RCM 1
+
+static const char* const reorder_names[2] = {"none", "rcm"};
+
+//what is timed: one product, or the conjugate gradient solver built on it (see cg.h)
+#define SOLVER_SPMV 0
+#define SOLVER_CG 1
+
+static const char* const solver_names[2] = {"spmv", "cg"};
+
+//product with the transpose y = A^T*x on the CSR arrays (see transpose_spmv.h)
+#define TRANSPOSE_OFF 0         //y = A*x
+#define TRANSPOSE_AUTO 1        //buffers or csc, chosen with the memory budget
+#define TRANSPOSE_BUFFERS 2     //scatter into per-thread buffers, then reduction
+#define TRANSPOSE_CSC 3         //column index built on the first product
+
+static const char* const transpose_names[4] = {"off", "auto", "buffers", "csc"};
+
+//per-thread profile of the csr loop (see thread_profile.h)
+#define PROFILE_OFF 0
+#define PROFILE_CURRENT 1       //schedule of the binary (or of the engine)
+#define PROFILE_SCHEDULES 2     //every schedule of the tuner
+
+static const char* const profile_names[3] = {"off", "current", "schedules"};
+
+#define BENCH_DEFAULT_REPETITIONS 30    //timed products when --bench-output is given without --iterations
+
+struct SpmvOptions {
+    const char* matrix_path;
+    int kernel;
+    int sell_c;         //rows per SELL chunk (4, 8 or 16)
+    int sell_sigma;     //sorting window of SELL (1 = no sorting)
+    int bcsr_r;         //BCSR block size (0 = chosen automatically)
+    int bcsr_c;
+    long long cache_size;   //bytes of cache for the tiled kernel (0 = detected)
+    int prefetch_distance;  //look-ahead of the prefetch kernel in entries (-1 = sweep)
+    int precision;      //PRECISION_DOUBLE, PRECISION_FLOAT or PRECISION_FLOAT_X
+    int vectors;        //number of right-hand sides (1 = SpMV, more = SpMM on an interleaved block)
+    int placement;      //PLACEMENT_* (-1 = not given: none, without the placement report)
+    int reorder;        //REORDER_NONE or REORDER_RCM
+    int solver;         //SOLVER_SPMV or SOLVER_CG
+    int cg_iterations;  //maximum number of CG iterations
+    double cg_tolerance;    //CG stops when ||r|| <= cg_tolerance * ||b||
+    int iterations;     //timed products, the output of each is the input of the next (0 = one cold product)
+    int warmup;         //untimed products before them
+    int transpose;      //TRANSPOSE_* (TRANSPOSE_OFF = y = A*x)
+    long long transpose_budget; //bytes of extra storage allowed to the transpose product (0 = size of the CSR arrays)
+    const char* bench_output;   //file of the benchmark records (NULL = none, see bench_harness.h)
+    int perf_counters;  //1: hardware counters of the timed products only (see perf_counters.h)
+    int roofline;       //1: STREAM bandwidth and achieved against attainable GFLOP/s after the product (see roofline.h)
+    int profile;        //PROFILE_*: rows, nonzeros, chunks, busy and barrier time of every thread instead of the product
+
+    //engine only
+    int engine;
+    int schedule_kind;  //SCHEDULE_* (-1 = chosen by the tuner)
+    int schedule_chunk; //0 = default chunk of the kind
+    int threads;        //0 = chosen by the tuner
+    int tune;           //TUNE_AUTO, TUNE_FORCE or TUNE_OFF
+};
+
+static inline void print_usage(const char* program, int engine = 0) {
+    fprintf(stderr,
+            "Usage: %s <matrix.mtx> [options]\n"
+            "  --kernel=csr|sell|bcsr|merge|sym|delta|balanced|tiled|prefetch|bucketed  SpMV kernel (default csr, sym only for symmetric matrices)\n"
+            "  --sell-c=4|8|16         rows per SELL chunk (default: SIMD width, 8 with AVX-512, 4 otherwise)\n"
+            "  --sell-sigma=N          SELL sorting window in rows (default 256, 1 = no sorting)\n"
+            "  --bcsr-block=auto|RxC   BCSR block size, R and C in {1,2,3,4,6} (default auto)\n"
+            "  --cache-size=N[K|M|G]   cache the column panels of the tiled kernel are sized for (default: detected)\n"
+            "  --prefetch-distance=d|sweep  entries of look-ahead of the prefetch kernel (default 32), sweep: GFLOP/s for every d\n"
+            "  --precision=double|float|float-x  storage of values (float) and x (float-x), accumulation in double (csr kernel, float also bucketed)\n"
+            "  --vectors=k             multiply a block of k = 1..32 interleaved vectors at once (SpMM, csr kernel)\n"
+            "  --placement=none|first-touch|interleave  NUMA placement of the arrays (interleave: x on all nodes), prints the pages per node\n"
+            "  --reorder=none|rcm      reverse Cuthill-McKee renumbering of rows and columns before the product\n"
+            "  --solver=spmv|cg        time one product (default) or the conjugate gradient solver (csr kernel, SPD matrices)\n"
+            "  --cg-tolerance=t        CG stops at ||r|| <= t*||b|| (default 1e-8)\n"
+            "  --cg-iterations=N       maximum number of CG iterations (default 1000)\n"
+            "  --iterations=N          time N products in one parallel region, y fed back as x (default: one cold product)\n"
+            "  --warmup=W              untimed products before the N timed ones (default 3)\n"
+            "  --transpose=off|auto|buffers|csc  compute y = A^T*x: per-thread buffers or csc index built on first use (csr kernel)\n"
+            "  --transpose-budget=N[K|M|G]  extra memory allowed to the transpose product (default: size of the CSR arrays)\n"
+            "  --bench-output=FILE     append the statistics of the timed products to FILE (.json: JSON Lines, otherwise CSV)\n"
+            "  --perf-counters         per-thread cycles, instructions, L1 and LLC loads/misses of the timed products (stderr)\n"
+            "  --roofline              STREAM triad bandwidth, traffic of the kernel, achieved vs attainable GFLOP/s (stderr)\n"
+            "  --profile[=current|schedules]  per-thread rows, nnz, chunks, busy/barrier time: imbalance and scheduling overhead (csr loop)\n",
+            program);
+    if (engine)
+        fprintf(stderr,
+                "  --schedule=KIND[,CHUNK] static|dynamic|guided schedule of the kernel (default: tuned)\n"
+                "  --threads=N             number of OpenMP threads (default: tuned)\n"
+                "  --tune=auto|force|off   auto: tuning cache or search, force: search again, off: no tuning (default auto)\n");
+}
+
+//returns the text after "--name=" if arg is that option, NULL otherwise
+static inline const char* option_value(const char* arg, const char* name) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') return arg + len + 1;
+    return NULL;
+}
+
+//strict integer conversion (the whole text must be a number in the range of int); quiet: no message (MPI ranks > 0)
+static inline int parse_int_option(const char* text, const char* name, int& out, int quiet = 0) {
+    char* end;
+    long v = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || v < INT_MIN || v > INT_MAX) {
+        if (!quiet) fprintf(stderr, "[ERR] Invalid value for %s: %s\n", name, text);
+        return 1;
+    }
+    out = (int)v;
+    return 0;
+}
+
+//strict floating point conversion, same rules as parse_int_option
+static inline int parse_double_option(const char* text, const char* name, double& out, int quiet = 0) {
+    char* end;
+    double v = strtod(text, &end);
+    if (*text == '\0' || *end != '\0') {
+        if (!quiet) fprintf(stderr, "[ERR] Invalid value for %s: %s\n", name, text);
+        return 1;
+    }
+    out = v;
+    return 0;
+}
+
+//size in bytes, optionally followed by K, M or G (strictly positive)
+static inline int parse_size_option(const char* text, long long& out) {
+    char* end;
+    out = strtoll(text, &end, 10);
+    if (*end == 'K' || *end == 'k') { out <<= 10; end++; }
+    else if (*end == 'M' || *end == 'm') { out <<= 20; end++; }
+    else if (*end == 'G' || *end == 'g') { out <<= 30; end++; }
+    return end == text || *end != '\0' || out < 1;
+}
+
+//"--precision=..." value -> PRECISION_*, -1 if unknown (also used by the MPI binary, so it does not print)
+static inline int parse_precision(const char* text) {
+    for (int p = 0; p < PRECISION_COUNT; p++)
+        if (strcmp(text, precision_names[p]) == 0) return p;
+    return -1;
+}
+
+static inline int valid_bcsr_dim(int d) {
+    return d == 1 || d == 2 || d == 3 || d == 4 || d == 6;
+}
+
+//"static|dynamic|guided[,chunk]" -> kind and chunk, 1 if wrong
+static inline int parse_schedule(const char* text, int& kind, int& chunk) {
+    const char* comma = strchr(text, ',');
+    size_t len = comma ? (size_t)(comma - text) : strlen(text);
+    kind = -1;
+    for (int k = SCHEDULE_STATIC; k <= SCHEDULE_GUIDED; k++)
+        if (strlen(schedule_names[k]) == len && strncmp(text, schedule_names[k], len) == 0) kind = k;
+    chunk = 0;
+    if (kind < 0) return 1;
+    if (comma && (parse_int_option(comma + 1, "--schedule", chunk) || chunk < 1)) return 1;
+    return 0;
+}
+
+static inline int parse_options(int argc, char* argv[], SpmvOptions& opts, int engine = 0) {
+    opts.matrix_path = NULL;
+    opts.kernel = engine ? -1 : KERNEL_CSR;
+#if defined(__AVX512F__)
+    opts.sell_c = 8;
+#else
+    opts.sell_c = 4;
+#endif
+    opts.sell_sigma = 256;
+    opts.bcsr_r = 0;
+    opts.bcsr_c = 0;
+    opts.cache_size = 0;
+    opts.prefetch_distance = 32;
+    opts.precision = PRECISION_DOUBLE;
+    opts.vectors = 1;
+    opts.placement = -1;
+    opts.reorder = REORDER_NONE;
+    opts.solver = SOLVER_SPMV;
+    opts.cg_iterations = 1000;
+    opts.cg_tolerance = 1e-8;
+    opts.iterations = 0;
+    opts.warmup = 3;
+    opts.transpose = TRANSPOSE_OFF;
+    opts.transpose_budget = 0;
+    opts.bench_output = NULL;
+    opts.perf_counters = 0;
+    opts.roofline = 0;
+    opts.profile = PROFILE_OFF;
+    opts.engine = engine;
+    opts.schedule_kind = -1;
+    opts.schedule_chunk = 0;
+    opts.threads = 0;
+    opts.tune = TUNE_AUTO;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* v;
+
+        if (strncmp(arg, "--", 2) != 0) {
+            if (opts.matrix_path) {
+                fprintf(stderr, "[ERR] Missing argument (or extra argument added) when executing the file\n");
+                print_usage(argv[0], engine);
+                return 1;
+            }
+            opts.matrix_path = arg;
+        }
+        else if ((v = option_value(arg, "--kernel"))) {
+            opts.kernel = -1;
+            for (int k = 0; k < KERNEL_COUNT; k++)
+                if (strcmp(v, kernel_names[k]) == 0) opts.kernel = k;
+            if (opts.kernel < 0) {
+                fprintf(stderr, "[ERR] Unknown kernel: %s\n", v);
+                print_usage(argv[0], engine);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--sell-c"))) {
+            if (parse_int_option(v, "--sell-c", opts.sell_c)) return 1;
+            if (opts.sell_c != 4 && opts.sell_c != 8 && opts.sell_c != 16) {
+                fprintf(stderr, "[ERR] --sell-c must be 4, 8 or 16\n");
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--sell-sigma"))) {
+            if (parse_int_option(v, "--sell-sigma", opts.sell_sigma) || opts.sell_sigma < 1) {
+                fprintf(stderr, "[ERR] --sell-sigma must be a positive number of rows\n");
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--bcsr-block"))) {
+            if (strcmp(v, "auto") == 0) {
+                opts.bcsr_r = 0;
+                opts.bcsr_c = 0;
+            }
+            else if (sscanf(v, "%dx%d", &opts.bcsr_r, &opts.bcsr_c) != 2 || !valid_bcsr_dim(opts.bcsr_r) || !valid_bcsr_dim(opts.bcsr_c)) {
+                fprintf(stderr, "[ERR] --bcsr-block must be auto or RxC with R and C in {1,2,3,4,6}: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--cache-size"))) {
+            if (parse_size_option(v, opts.cache_size)) {
+                fprintf(stderr, "[ERR] --cache-size must be a positive size in bytes, optionally followed by K, M or G: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--prefetch-distance"))) {
+            if (strcmp(v, "sweep") == 0)
+                opts.prefetch_distance = -1;
+            else if (parse_int_option(v, "--prefetch-distance", opts.prefetch_distance) || opts.prefetch_distance < 0) {
+                fprintf(stderr, "[ERR] --prefetch-distance must be a number of entries >= 0 or sweep\n");
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--precision"))) {
+            if ((opts.precision = parse_precision(v)) < 0) {
+                fprintf(stderr, "[ERR] Unknown precision: %s (double, float or float-x)\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--vectors"))) {
+            if (parse_int_option(v, "--vectors", opts.vectors) || opts.vectors < 1 || opts.vectors > 32) {
+                fprintf(stderr, "[ERR] --vectors must be between 1 and 32\n");
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--placement"))) {
+            opts.placement = -1;
+            for (int p = 0; p < 3; p++)
+                if (strcmp(v, placement_names[p]) == 0) opts.placement = p;
+            if (opts.placement < 0) {
+                fprintf(stderr, "[ERR] --placement must be none, first-touch or interleave: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--reorder"))) {
+            opts.reorder = -1;
+            for (int r = 0; r < 2; r++)
+                if (strcmp(v, reorder_names[r]) == 0) opts.reorder = r;
+            if (opts.reorder < 0) {
+                fprintf(stderr, "[ERR] --reorder must be none or rcm: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--solver"))) {
+            opts.solver = -1;
+            for (int s = 0; s < 2; s++)
+                if (strcmp(v, solver_names[s]) == 0) opts.solver = s;
+            if (opts.solver < 0) {
+                fprintf(stderr, "[ERR] --solver must be spmv or cg: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--cg-iterations"))) {
+            if (parse_int_option(v, "--cg-iterations", opts.cg_iterations) || opts.cg_iterations < 1) {
+                fprintf(stderr, "[ERR] --cg-iterations must be a positive number\n");
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--cg-tolerance"))) {
+            if (parse_double_option(v, "--cg-tolerance", opts.cg_tolerance) || opts.cg_tolerance < 0.0) {
+                fprintf(stderr, "[ERR] --cg-tolerance must be a number >= 0: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--iterations"))) {
+            if (parse_int_option(v, "--iterations", opts.iterations) || opts.iterations < 1) {
+                fprintf(stderr, "[ERR] --iterations must be a positive number\n");
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--warmup"))) {
+            if (parse_int_option(v, "--warmup", opts.warmup) || opts.warmup < 0) {
+                fprintf(stderr, "[ERR] --warmup must be a number >= 0\n");
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--transpose"))) {
+            opts.transpose = -1;
+            for (int t = 0; t < 4; t++)
+                if (strcmp(v, transpose_names[t]) == 0) opts.transpose = t;
+            if (opts.transpose < 0) {
+                fprintf(stderr, "[ERR] --transpose must be off, auto, buffers or csc: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--transpose-budget"))) {
+            if (parse_size_option(v, opts.transpose_budget)) {
+                fprintf(stderr, "[ERR] --transpose-budget must be a positive size in bytes, optionally followed by K, M or G: %s\n", v);
+                return 1;
+            }
+        }
+        else if ((v = option_value(arg, "--bench-output"))) {
+            if (*v == '\0') {
+                fprintf(stderr, "[ERR] --bench-output needs a file name\n");
+                return 1;
+            }
+            opts.bench_output = v;
+        }
+        else if (strcmp(arg, "--perf-counters") == 0)
+            opts.perf_counters = 1;
+        else if (strcmp(arg, "--roofline") == 0)
+            opts.roofline = 1;
+        else if (strcmp(arg, "--profile") == 0)
+            opts.profile = PROFILE_CURRENT;
+        else if ((v = option_value(arg, "--profile"))) {
+            opts.profile = -1;
+            for (int p = 0; p < 3; p++)
+                if (strcmp(v, profile_names[p]) == 0) opts.profile = p;
+            if (opts.profile < 0) {
+                fprintf(stderr, "[ERR] --profile must be off, current or schedules: %s\n", v);
+                return 1;
+            }
+        }
+        else if (engine && (v = option_value(arg, "--schedule"))) {
+            if (parse_schedule(v, opts.schedule_kind, opts.schedule_chunk)) {
+                fprintf(stderr, "[ERR] --schedule must be static, dynamic or guided, optionally followed by ,chunk: %s\n", v);
+                return 1;
+            }
+        }
+        else if (engine && (v = option_value(arg, "--threads"))) {
+            if (parse_int_option(v, "--threads", opts.threads) || opts.threads < 1) {
+                fprintf(stderr, "[ERR] --threads must be a positive number\n");
+                return 1;
+            }
+        }
+        else if (engine && (v = option_value(arg, "--tune"))) {
+            opts.tune = -1;
+            for (int t = 0; t < 3; t++)
+                if (strcmp(v, tune_names[t]) == 0) opts.tune = t;
+            if (opts.tune < 0) {
+                fprintf(stderr, "[ERR] --tune must be auto, force or off: %s\n", v);
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr, "[ERR] Unknown option: %s\n", arg);
+            print_usage(argv[0], engine);
+            return 1;
+        }
+    }
+
+    if (!opts.matrix_path) {
+        fprintf(stderr, "[ERR] Missing argument (or extra argument added) when executing the file\n");
+        print_usage(argv[0], engine);
+        return 1;
+    }
+    if (opts.prefetch_distance < 0 && opts.kernel != KERNEL_PREFETCH) {
+        fprintf(stderr, "[ERR] --prefetch-distance=sweep times the prefetch kernel: only with --kernel=prefetch\n");
+        return 1;
+    }
+    if ((opts.perf_counters || opts.roofline || opts.profile != PROFILE_OFF) && (opts.solver == SOLVER_CG || opts.prefetch_distance < 0)) {
+        fprintf(stderr, "[ERR] --perf-counters, --roofline and --profile measure the SpMV products: not with --solver=cg or --prefetch-distance=sweep\n");
+        return 1;
+    }
+    if (opts.profile != PROFILE_OFF && (opts.perf_counters || opts.roofline || opts.bench_output)) {
+        fprintf(stderr, "[ERR] --profile replaces the timed products: not with --perf-counters, --roofline or --bench-output\n");
+        return 1;
+    }
+    //the records need repeated products: --bench-output alone switches them on
+    if (opts.bench_output && opts.iterations == 0) opts.iterations = BENCH_DEFAULT_REPETITIONS;
+    return 0;
+}
+
+#endif
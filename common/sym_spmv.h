@@ -0,0 +1,149 @@
+#ifndef SYM_SPMV_H
+#define SYM_SPMV_H
+
+/*
+ * SYMMETRIC SpMV ON THE HALF STORAGE (LOWER TRIANGLE + DIAGONAL, see load_csr(..., half_storage = 1))
+ *
+ * Every stored off-diagonal entry a(r,c), c < r, is used twice: y[r] += a * x[c] and y[c] += a * x[r]
+ * (-a for skew-symmetric matrices), so the matrix is read once for both triangles and the memory traffic is
+ * about half of the expanded CSR.
+ *
+ * The second update writes to row c, which may belong to another thread. The rows are split in one contiguous
+ * block per thread, balanced by nonzeros; thread t owns the rows [row_start[t], row_start[t+1]) and:
+ *   - adds the updates to its own rows directly into y;
+ *   - adds the updates to the rows of the previous threads into a private buffer, which only covers the
+ *     columns it can reach: [min_col[t], row_start[t]) (small for banded/FEM matrices);
+ *   - after a barrier, every thread adds to its own rows the buffers of the following threads that overlap them.
+ * If the buffers together would be larger than y (wide matrices, many threads), every update of y is done
+ * with an atomic instead, so the memory used stays bounded.
+ */
+
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+#include "row_partition.h"
+
+struct SymSpmv {
+    const CSRMatrix* csr;
+    double sign;                    //1 symmetric, -1 skew-symmetric (sign of the mirrored entries)
+    int n_threads;
+    int use_atomic;                 //1 if the buffers would not fit in the budget
+    std::vector<int> row_start;     //first row of every thread (n_threads + 1)
+    std::vector<int> min_col;       //first column reached by every thread
+    std::vector<long long> buffer_offset;   //position of the buffer of every thread (n_threads + 1)
+    std::vector<double> buffers;
+};
+
+static inline void prepare_sym(const CSRMatrix& csr, SymSpmv& s) {
+    int rows_number = csr.rows_number;
+    const int* rows_ptr = csr.rows_ptr;
+
+    s.csr = &csr;
+    s.sign = csr.is_symmetric == MTX_SKEW_SYMMETRIC ? -1.0 : 1.0;
+    s.n_threads = 1;
+#ifdef _OPENMP
+    s.n_threads = omp_get_max_threads();
+#endif
+    int T = s.n_threads;
+
+    //contiguous blocks of rows with about nnz/T entries each
+    RowPartition partition;
+    build_row_partition(rows_ptr, rows_number, T, partition);
+    s.row_start.swap(partition.row_start);
+
+    //smallest column of every block (the rows are sorted by column, so it is the first entry of a row)
+    s.min_col.resize(T);
+    s.buffer_offset.assign(T + 1, 0);
+    #pragma omp parallel for schedule(static, 1) num_threads(T)
+    for (int t = 0; t < T; t++) {
+        int lo = s.row_start[t], hi = s.row_start[t + 1];
+        int m = lo;
+        for (int r = lo; r < hi; r++)
+            if (rows_ptr[r] < rows_ptr[r + 1]) m = std::min(m, csr.cols[rows_ptr[r]]);
+        s.min_col[t] = m;
+    }
+    for (int t = 0; t < T; t++)
+        s.buffer_offset[t + 1] = s.buffer_offset[t] + (s.row_start[t] - s.min_col[t]);
+
+    s.use_atomic = s.buffer_offset[T] > rows_number;
+    if (!s.use_atomic) s.buffers.resize(s.buffer_offset[T]);
+}
+
+/*y = A*x WITH A STORED AS LOWER TRIANGLE + DIAGONAL*/
+static inline void spmv_sym(SymSpmv& s, const double* x, double* y) {
+    const CSRMatrix& csr = *s.csr;
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    const double sign = s.sign;
+    int T = s.n_threads;
+
+    if (s.use_atomic) {
+        #pragma omp parallel num_threads(T)
+        {
+            #pragma omp for schedule(static)
+            for (int r = 0; r < csr.rows_number; r++) y[r] = 0.0;
+
+            #pragma omp for schedule(static, 1)
+            for (int t = 0; t < T; t++) {
+                for (int r = s.row_start[t]; r < s.row_start[t + 1]; r++) {
+                    double sum = 0.0, xr = x[r];
+                    for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+                        int c = cols[idx];
+                        sum += values[idx] * x[c];
+                        if (c != r) {
+                            #pragma omp atomic
+                            y[c] += sign * values[idx] * xr;
+                        }
+                    }
+                    #pragma omp atomic
+                    y[r] += sum;
+                }
+            }
+        }
+        return;
+    }
+
+    #pragma omp parallel num_threads(T)
+    {
+        #pragma omp for schedule(static, 1)
+        for (int t = 0; t < T; t++) {
+            int lo = s.row_start[t], hi = s.row_start[t + 1];
+            double* buffer = s.buffers.data() + s.buffer_offset[t] - s.min_col[t];    //indexed by column
+
+            for (int c = s.min_col[t]; c < lo; c++) buffer[c] = 0.0;
+            for (int r = lo; r < hi; r++) y[r] = 0.0;
+
+            for (int r = lo; r < hi; r++) {
+                double sum = 0.0, xr = x[r];
+                for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+                    int c = cols[idx];
+                    double a = values[idx];
+                    sum += a * x[c];
+                    if (c == r) continue;
+                    if (c >= lo)
+                        y[c] += sign * a * xr;
+                    else
+                        buffer[c] += sign * a * xr;
+                }
+                y[r] += sum;
+            }
+        }
+
+        //the implicit barrier of the loop above separates the two phases
+        #pragma omp for schedule(static, 1)
+        for (int t = 0; t < T; t++) {
+            int lo = s.row_start[t], hi = s.row_start[t + 1];
+            for (int u = t + 1; u < T; u++) {
+                const double* buffer = s.buffers.data() + s.buffer_offset[u] - s.min_col[u];
+                int from = std::max(lo, s.min_col[u]), to = std::min(hi, s.row_start[u]);
+                for (int c = from; c < to; c++) y[c] += buffer[c];
+            }
+        }
+    }
+}
+
+#endif
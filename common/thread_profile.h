@@ -0,0 +1,192 @@
+#ifndef THREAD_PROFILE_H
+#define THREAD_PROFILE_H
+
+/*
+ * PER-THREAD PROFILE OF THE CSR LOOP (--profile=current|schedules)
+ *
+ * The binaries only give the wall time of the product, so imbalance and scheduling overhead have to be guessed from
+ * the speedup curves. In this mode the CSR loop of the file is run again in an instrumented copy (the timed loop of
+ * the binaries is not touched, so without the option nothing changes): same "omp for schedule(runtime)" as the
+ * file, but every thread counts its rows, nonzeros and chunks and takes three time stamps:
+ *   fork = entry in the parallel region - start of the region (creation/wake-up of the team),
+ *   busy = end of its share of the loop (nowait) - entry,
+ *   wait = exit from the barrier that ends the loop - end of its share.
+ * The chunks are the runs of consecutive rows, split at the multiples of the chunk size for static,c and dynamic,c
+ * (dynamic without chunk: 1 row per chunk); guided chunks taken back to back by the same thread count as one.
+ * The dequeue cost is measured with the same loop and schedule over the same rows with an empty body (only the
+ * runtime handing out the chunks): summed over the threads and divided by the summed busy time it is the
+ * scheduling overhead. The imbalance factor is max/mean of the busy times (1 = perfect), and the same for the
+ * nonzeros tells whether the imbalance comes from the distribution of the work or from the speed of the threads.
+ * opts.warmup untimed products come first, then max(opts.iterations, 1) profiled ones (averaged per product).
+ * "schedules" repeats the profile for every schedule of the tuner (autotune.h), then restores the schedule of the file.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+#include "spmv_kernels.h"
+#include "autotune.h"
+
+struct ThreadProfile {
+    long long rows;
+    long long nnz;
+    long long chunks;
+    double fork;        //seconds from the start of the region to the entry of the thread
+    double busy;        //seconds of the share of the loop
+    double wait;        //seconds in the barrier at the end of the loop
+    double dequeue;     //seconds of the same loop with an empty body
+};
+
+static inline double profile_clock() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//schedule in use for schedule(runtime), without the monotonic modifier
+static inline void profile_schedule(int& kind, int& chunk) {
+#ifdef _OPENMP
+    omp_sched_t k;
+    omp_get_schedule(&k, &chunk);
+    kind = (int)k & 0xff;
+#else
+    kind = SCHEDULE_STATIC;
+    chunk = 0;
+#endif
+}
+
+/*ONE INSTRUMENTED PRODUCT (empty: ONLY THE LOOP OF THE RUNTIME, FOR THE DEQUEUE COST); THE COUNTS ARE ADDED TO p*/
+static inline void profile_product(const CSRMatrix& csr, const double* x, double* y, int empty, std::vector<ThreadProfile>& p) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    int rows_number = csr.rows_number;
+    int kind, chunk;
+    profile_schedule(kind, chunk);
+    if (kind == SCHEDULE_DYNAMIC && chunk < 1) chunk = 1;
+    int aligned = chunk > 0 && (kind == SCHEDULE_DYNAMIC || kind == SCHEDULE_STATIC);   //chunks start at multiples of chunk
+
+    double region_start = profile_clock();
+    #pragma omp parallel
+    {
+        double entry = profile_clock();
+#ifdef _OPENMP
+        int tid = omp_get_thread_num();
+#else
+        int tid = 0;
+#endif
+        long long rows = 0, nnz = 0, chunks = 0;
+        int last = -2, next_boundary = 0;
+
+        if (empty) {
+            #pragma omp for schedule(runtime) nowait
+            for (int r = 0; r < rows_number; r++) rows++;
+        }
+        else {
+            #pragma omp for schedule(runtime) nowait
+            for (int r = 0; r < rows_number; r++) {
+                if (r != last + 1 || (aligned && r == next_boundary)) {
+                    chunks++;
+                    if (aligned) next_boundary = (r / chunk + 1) * chunk;
+                }
+                last = r;
+                double sum = 0.0;
+                for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++)
+                    sum += values[idx] * x[cols[idx]];
+                y[r] = sum;
+                rows++;
+                nnz += rows_ptr[r + 1] - rows_ptr[r];
+            }
+        }
+        double done = profile_clock();
+        #pragma omp barrier
+        double left = profile_clock();
+
+        ThreadProfile& t = p[tid];
+        if (empty)
+            t.dequeue += done - entry;
+        else {
+            t.rows += rows;
+            t.nnz += nnz;
+            t.chunks += chunks;
+            t.fork += entry - region_start;
+            t.busy += done - entry;
+            t.wait += left - done;
+        }
+    }
+}
+
+/*PROFILE OF THE CURRENT SCHEDULE: [PROFILE] LINES PER THREAD ON stderr, THEN THE SUMMARY ON stdout:
+  matrix:profile:kind,chunk:threads:products:imbalance (busy):imbalance (nnz):barrier wait %:scheduling overhead %:mean fork (s)*/
+static inline void profile_schedule_run(const char* filename, const SpmvOptions& opts, const CSRMatrix& csr, double* x, double* y) {
+#ifdef _OPENMP
+    int T = omp_get_max_threads();
+#else
+    int T = 1;
+#endif
+    int products = std::max(opts.iterations, 1);
+    std::vector<ThreadProfile> p(T), unused(T);
+    for (int t = 0; t < T; t++) p[t] = ThreadProfile();
+
+    for (int it = 0; it < opts.warmup; it++) profile_product(csr, x, y, 0, unused);
+    for (int it = 0; it < products; it++) profile_product(csr, x, y, 0, p);
+    for (int it = 0; it < products; it++) profile_product(csr, x, y, 1, p);
+
+    int kind, chunk;
+    profile_schedule(kind, chunk);
+    char schedule[32];
+    snprintf(schedule, sizeof(schedule), "%s,%d", kind >= SCHEDULE_STATIC && kind <= SCHEDULE_GUIDED ? schedule_names[kind] : "auto", chunk);
+
+    double max_busy = 0.0, sum_busy = 0.0, sum_wait = 0.0, sum_fork = 0.0, sum_dequeue = 0.0;
+    long long max_nnz = 0, sum_nnz = 0;
+    for (int t = 0; t < T; t++) {
+        const ThreadProfile& q = p[t];
+        fprintf(stderr, "[PROFILE] %s | thread %d | rows %lld | nnz %lld | chunks %lld | busy %.6f ms | wait %.6f ms | fork %.3f us | dequeue %.6f ms\n",
+                schedule, t, q.rows / products, q.nnz / products, q.chunks / products, 1e3 * q.busy / products,
+                1e3 * q.wait / products, 1e6 * q.fork / products, 1e3 * q.dequeue / products);
+        max_busy = std::max(max_busy, q.busy);
+        sum_busy += q.busy;
+        sum_wait += q.wait;
+        sum_fork += q.fork;
+        sum_dequeue += q.dequeue;
+        max_nnz = std::max(max_nnz, q.nnz);
+        sum_nnz += q.nnz;
+    }
+    double mean_busy = sum_busy / T, mean_nnz = (double)sum_nnz / T;
+    printf("%s:profile:%s:%d:%d:%.3f:%.3f:%.2f:%.2f:%.9f\n", filename, schedule, T, products,
+           mean_busy > 0.0 ? max_busy / mean_busy : 1.0, mean_nnz > 0.0 ? max_nnz / mean_nnz : 1.0,
+           sum_busy + sum_wait > 0.0 ? 100.0 * sum_wait / (sum_busy + sum_wait) : 0.0,
+           sum_busy > 0.0 ? 100.0 * sum_dequeue / sum_busy : 0.0, sum_fork / T / products);
+}
+
+/*--profile: THE SCHEDULE OF THE FILE, OR ALL THE SCHEDULES OF THE TUNER (THE SCHEDULE OF THE FILE IS RESTORED), 0 IF DONE*/
+static inline int profile_run(const char* filename, const SpmvOptions& opts, const CSRMatrix& csr, double* x, double* y) {
+    if (!default_csr_loop(opts)) {
+        fprintf(stderr, "[ERR] --profile instruments the csr loop: csr kernel in double precision with one vector (no --transpose)\n");
+        return 1;
+    }
+    if (opts.profile == PROFILE_CURRENT) {
+        profile_schedule_run(filename, opts, csr, x, y);
+        return 0;
+    }
+#ifdef _OPENMP
+    omp_sched_t kind;
+    int chunk;
+    omp_get_schedule(&kind, &chunk);
+    for (int s = 0; s < TUNE_N_SCHEDULES; s++) {
+        omp_set_schedule((omp_sched_t)tune_schedules[s][0], tune_schedules[s][1]);
+        profile_schedule_run(filename, opts, csr, x, y);
+    }
+    omp_set_schedule(kind, chunk);
+#else
+    profile_schedule_run(filename, opts, csr, x, y);
+#endif
+    return 0;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef TRANSPOSE_SPMV_H
+#define TRANSPOSE_SPMV_H
+
+/*
+ * TRANSPOSE PRODUCT y = A^T*x ON THE CSR ARRAYS (--transpose=auto|buffers|csc)
+ *
+ * In CSR the transpose product is a scatter: entry a(r,c) adds a * x[r] to y[c], and row r of one thread can
+ * reach the same c as a row of another thread. Two ways to compute it without writing A^T in advance:
+ *   - buffers: the rows are split in nnz-balanced blocks (row_partition.h); every thread scatters into a private
+ *     buffer that only covers the columns its rows reach, [min_col[t], max_col[t]] (a band for banded/FEM
+ *     matrices), then y is split in column blocks and every thread sums the parts of the buffers overlapping its
+ *     block. Extra memory: the sum of the spans (8 bytes each); extra work: zeroing and summing them.
+ *   - csc: the index of A by columns (column pointers, row of every entry, values: CSR of A^T), built on the
+ *     first transpose product with an atomic counting sort and kept for the next ones; the product is then a
+ *     gather over the columns, like the CSR kernel (schedule(runtime)). Extra memory: (columns + 1)*4 + nnz*12.
+ * auto takes the buffers when they fit the memory budget and the sum of the spans is at most nnz (the
+ * reduction adds at most one read per nonzero), otherwise the csc index if it fits the budget, otherwise the
+ * buffers if they fit, otherwise the smaller of the two. The number of rows enters through the spans: with
+ * few, long rows every block reaches almost all the columns and the buffers grow to threads * columns.
+ * The budget is --transpose-budget, by default the size of the CSR arrays.
+ */
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "csr_matrix.h"
+#include "row_partition.h"
+#include "spmv_options.h"
+
+struct TransposeSpmv {
+    int method;                     //TRANSPOSE_BUFFERS or TRANSPOSE_CSC (TRANSPOSE_OFF: not used)
+    const CSRMatrix* csr;
+    long long budget;               //bytes allowed for the extra storage
+    long long buffer_bytes;         //size of the per-thread buffers
+    long long csc_bytes;            //size of the csc index
+
+    //per-thread buffers
+    RowPartition partition;
+    std::vector<int> min_col;       //columns reached by the rows of every thread (max_col < min_col: none)
+    std::vector<int> max_col;
+    std::vector<long long> buffer_offset;   //position of the buffer of every thread (n_threads + 1)
+    std::vector<double> buffers;
+
+    //csc index, built by the first product
+    int csc_built;
+    std::vector<int> csc_ptr;
+    std::vector<int> csc_rows;
+    std::vector<double> csc_values;
+
+    TransposeSpmv() : method(TRANSPOSE_OFF), csr(NULL), budget(0), buffer_bytes(0), csc_bytes(0), csc_built(0) {}
+};
+
+static inline void prepare_transpose(const CSRMatrix& csr, int method, long long budget, TransposeSpmv& t) {
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+
+    t.csr = &csr;
+    t.csc_built = 0;
+    t.budget = budget > 0 ? budget : (long long)(csr.rows_number + 1) * sizeof(int) + (long long)csr.nnz * (sizeof(int) + sizeof(double));
+
+    build_row_partition(csr, t.partition);
+    int T = t.partition.n_threads;
+    const int* row_start = t.partition.row_start.data();
+
+    //columns reached by every block: the rows are sorted by column, so only their first and last entries are read
+    t.min_col.assign(T, 0);
+    t.max_col.assign(T, -1);
+    #pragma omp parallel for schedule(static, 1) num_threads(T)
+    for (int th = 0; th < T; th++) {
+        int lo = csr.columns_number, hi = -1;
+        for (int r = row_start[th]; r < row_start[th + 1]; r++) {
+            if (rows_ptr[r] == rows_ptr[r + 1]) continue;
+            lo = std::min(lo, cols[rows_ptr[r]]);
+            hi = std::max(hi, cols[rows_ptr[r + 1] - 1]);
+        }
+        if (hi >= 0) {
+            t.min_col[th] = lo;
+            t.max_col[th] = hi;
+        }
+    }
+    t.buffer_offset.assign(T + 1, 0);
+    for (int th = 0; th < T; th++)
+        t.buffer_offset[th + 1] = t.buffer_offset[th] + (t.max_col[th] - t.min_col[th] + 1);
+
+    t.buffer_bytes = t.buffer_offset[T] * (long long)sizeof(double);
+    t.csc_bytes = (long long)(csr.columns_number + 1) * sizeof(int) + (long long)csr.nnz * (sizeof(int) + sizeof(double));
+
+    if (method == TRANSPOSE_AUTO) {
+        if (t.buffer_bytes <= t.budget && t.buffer_offset[T] <= csr.nnz) method = TRANSPOSE_BUFFERS;
+        else if (t.csc_bytes <= t.budget) method = TRANSPOSE_CSC;
+        else if (t.buffer_bytes <= t.budget) method = TRANSPOSE_BUFFERS;
+        else method = t.buffer_bytes <= t.csc_bytes ? TRANSPOSE_BUFFERS : TRANSPOSE_CSC;
+    }
+    t.method = method;
+    if (method == TRANSPOSE_BUFFERS) t.buffers.resize(t.buffer_offset[T]);
+}
+
+/*CSC INDEX (CSR OF A^T): ATOMIC COLUMN HISTOGRAM, PREFIX SUM, ATOMIC SCATTER, THEN THE ROWS OF EVERY COLUMN ARE SORTED*/
+static inline void build_transpose_index(TransposeSpmv& t) {
+    const CSRMatrix& csr = *t.csr;
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    int columns_number = csr.columns_number;
+
+    t.csc_ptr.assign(columns_number + 1, 0);
+    t.csc_rows.resize(csr.nnz);
+    t.csc_values.resize(csr.nnz);
+    int* csc_ptr = t.csc_ptr.data();
+
+    #pragma omp parallel for schedule(static)
+    for (int idx = 0; idx < csr.nnz; idx++) {
+        #pragma omp atomic
+        csc_ptr[cols[idx]]++;
+    }
+    parallel_exclusive_scan(csc_ptr, columns_number);
+
+    std::vector<int> cursor(csc_ptr, csc_ptr + columns_number);
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < csr.rows_number; r++) {
+        for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++) {
+            int pos;
+            #pragma omp atomic capture
+            pos = cursor[cols[idx]]++;
+            t.csc_rows[pos] = r;
+            t.csc_values[pos] = values[idx];
+        }
+    }
+
+    sort_csr_rows(csc_ptr, columns_number, t.csc_rows.data(), t.csc_values.data());
+    t.csc_built = 1;
+}
+
+/*y = A^T*x (y HAS columns_number ELEMENTS, x rows_number)*/
+static inline void spmv_transpose(TransposeSpmv& t, const double* x, double* y) {
+    const CSRMatrix& csr = *t.csr;
+    int columns_number = csr.columns_number;
+
+    if (t.method == TRANSPOSE_CSC) {
+        if (!t.csc_built) build_transpose_index(t);
+        const int* csc_ptr = t.csc_ptr.data();
+        const int* csc_rows = t.csc_rows.data();
+        const double* csc_values = t.csc_values.data();
+
+        #pragma omp parallel for schedule(runtime)
+        for (int c = 0; c < columns_number; c++) {
+            double sum = 0.0;
+            for (int idx = csc_ptr[c]; idx < csc_ptr[c + 1]; idx++)
+                sum += csc_values[idx] * x[csc_rows[idx]];
+            y[c] = sum;
+        }
+        return;
+    }
+
+    const int* rows_ptr = csr.rows_ptr;
+    const int* cols = csr.cols;
+    const double* values = csr.values;
+    int T = t.partition.n_threads;
+    const int* row_start = t.partition.row_start.data();
+
+    #pragma omp parallel num_threads(T)
+    {
+        #pragma omp for schedule(static, 1)
+        for (int th = 0; th < T; th++) {
+            double* buffer = t.buffers.data() + t.buffer_offset[th] - t.min_col[th];    //indexed by column
+            for (int c = t.min_col[th]; c <= t.max_col[th]; c++) buffer[c] = 0.0;
+
+            for (int r = row_start[th]; r < row_start[th + 1]; r++) {
+                double xr = x[r];
+                for (int idx = rows_ptr[r]; idx < rows_ptr[r + 1]; idx++)
+                    buffer[cols[idx]] += values[idx] * xr;
+            }
+        }
+
+        //the implicit barrier of the loop above separates the two phases: block th of y sums the overlapping buffers
+        #pragma omp for schedule(static, 1)
+        for (int th = 0; th < T; th++) {
+            int lo = (int)((long long)columns_number * th / T), hi = (int)((long long)columns_number * (th + 1) / T);
+            for (int c = lo; c < hi; c++) y[c] = 0.0;
+            for (int u = 0; u < T; u++) {
+                const double* buffer = t.buffers.data() + t.buffer_offset[u] - t.min_col[u];
+                int from = std::max(lo, t.min_col[u]), to = std::min(hi, t.max_col[u] + 1);
+                for (int c = from; c < to; c++) y[c] += buffer[c];
+            }
+        }
+    }
+}
+
+//method chosen and sizes, on stderr
+static inline void transpose_report(const TransposeSpmv& t) {
+    if (t.method == TRANSPOSE_OFF) return;
+    fprintf(stderr, "[TRANSPOSE] %s | per-thread buffers %.1f MB (%d threads) | csc index %.1f MB | budget %.1f MB\n",
+            transpose_names[t.method], t.buffer_bytes / 1048576.0, t.partition.n_threads, t.csc_bytes / 1048576.0,
+            t.budget / 1048576.0);
+}
+
+#endif